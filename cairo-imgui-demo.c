@@ -5,7 +5,7 @@
 // Author: R.F. Smith <rsmith@xs4all.nl>
 // SPDX-License-Identifier: Unlicense
 // Created: 2025-08-18 14:53:46 +0200
-// Last modified: 2025-09-24T21:29:31+0200
+// Last modified: 2026-10-18T10:41:07+0200
 
 #define SDL_MAIN_USE_CALLBACKS 1
 #include <SDL3/SDL.h>
@@ -23,15 +23,18 @@ typedef struct {
   SDL_Texture *texture;
   GUI_context *ctx;
   bool checked;
+  bool direct;  // Draw on the window surface, without a renderer.
 } State;
 
 
 SDL_AppResult SDL_AppInit(void **appstate, int argc, char **argv)
 {
-  (void)argc;
-  (void)argv;
   // Initialize state needed in all functions.
   static State s = {0};
+  // Use “-s” for machines without a GPU.
+  if (argc > 1 && SDL_strcmp(argv[1], "-s") == 0) {
+    s.direct = true;
+  }
   // Create GUI context.
   static GUI_context ctx = {0};
   ctx.id = 1;
@@ -49,6 +52,14 @@ SDL_AppResult SDL_AppInit(void **appstate, int argc, char **argv)
   // Create window and renderer.
   int w = 400;
   int h = 300;
+  if (s.direct) {
+    s.window = SDL_CreateWindow("Cairo IMGUI demo", w, h, 0);
+    if (!s.window) {
+      SDL_Log("Couldn't create a window: %s", SDL_GetError());
+      return SDL_APP_FAILURE;
+    }
+    return SDL_APP_CONTINUE;
+  }
   if (!SDL_CreateWindowAndRenderer("Cairo IMGUI demo", w, h, 0,
                                    &s.window, &s.renderer)) {
     SDL_Log("Couldn't create a window and renderer: %s", SDL_GetError());
@@ -67,7 +78,11 @@ SDL_AppResult SDL_AppIterate(void *appstate)
   (void)appstate;
   State *s = appstate;
   // GUI definition starts here.
-  gui_begin(s->renderer, s->texture, s->ctx);
+  if (s->direct) {
+    gui_begin_window(s->window, s->ctx);
+  } else {
+    gui_begin(s->renderer, s->texture, s->ctx);
+  }
   // Buttom + label to show counter...
   static int count = 0;
   static char bbuf[40] = "Not pressed";
@@ -88,21 +103,41 @@ SDL_AppResult SDL_AppIterate(void *appstate)
   }
   gui_label(s->ctx, 100, 50, slabel);
   static const char *btns[2] = {"light", "dark"};
-  static int radio = 1;
-  gui_label(s->ctx, 10, 70, "Theme");
-  if (gui_radiobuttons(s->ctx, 10, 82, 2, btns, &radio)) {
-    if (radio == 0) {
+  // The selected theme is kept by the GUI instead of in a static. Widgets
+  // are always called, even without memory, so later widgets keep their IDs.
+  static int radio_fallback = 1;
+  bool isnew = false;
+  int *radio = gui_state(s->ctx, gui_hash("Theme"), sizeof(int), &isnew);
+  if (!radio) {
+    radio = &radio_fallback;
+  } else if (isnew) {
+    *radio = 1;
+  }
+  // The theme selection uses a layout instead of fixed positions.
+  static GUI_layout theme = {.dir = GUI_COLUMN, .spacing = 2.0};
+  double lx, ly;
+  gui_layout_begin(s->ctx, &theme, 10, 70);
+  gui_layout_next(s->ctx, &lx, &ly);
+  gui_label(s->ctx, lx, ly, "Theme");
+  gui_layout_next(s->ctx, &lx, &ly);
+  if (gui_radiobuttons(s->ctx, lx, ly, 2, btns, radio)) {
+    if (*radio == 0) {
       gui_theme_light(s->ctx);
       // puts("switching to light theme.");
-    } else if (radio == 1) {
+    } else if (*radio == 1) {
       gui_theme_dark(s->ctx);
       // puts("switching to dark theme.");
     }
   }
+  gui_layout_end(s->ctx);
   // Color sliders and sample.
-  gui_label(s->ctx, 10, 124, "Red");
-  gui_label(s->ctx, 10, 154, "Green");
-  gui_label(s->ctx, 10, 184, "Blue");
+  // These labels never change, so they are drawn from a cache.
+  if (gui_group_begin(s->ctx, 1, 10.0, 120.0, 45.0, 80.0, 0)) {
+    gui_label(s->ctx, 10, 124, "Red");
+    gui_label(s->ctx, 10, 154, "Green");
+    gui_label(s->ctx, 10, 184, "Blue");
+  }
+  gui_group_end(s->ctx);
   static int red = 0, green = 0, blue = 0;
   static GUI_rgb samplecolor = {0};
   static char bred[10] = {0}, bgreen[10] = {0}, bblue[10] = {0};
@@ -126,8 +161,12 @@ SDL_AppResult SDL_AppIterate(void *appstate)
   static int32_t ispinner = 17;
   gui_ispinner(s->ctx, 65.0, 210.0, 0, 255, &ispinner);
   // Edit box
-  static GUI_editstate es = {0};
-  gui_editbox(s->ctx, 150.0, 210.0, 100.0, &es);
+  static GUI_editstate es_fallback = {0};
+  GUI_editstate *es = gui_state(s->ctx, gui_hash("Edit"), sizeof(*es), 0);
+  if (!es) {
+    es = &es_fallback;
+  }
+  gui_editbox(s->ctx, 150.0, 210.0, 100.0, es);
   // Show cursor position to help with layout.
   char buf[80] = {0};
   snprintf(buf, 79, "x = %d, y = %d", s->ctx->mouse_x, s->ctx->mouse_y);
@@ -149,7 +188,10 @@ void SDL_AppQuit(void *appstate, SDL_AppResult result)
   State *s = appstate;
   (void)result;
   // Clean up.
-  SDL_DestroyTexture(s->texture);
+  gui_free(s->ctx);
+  if (!s->direct) {
+    SDL_DestroyTexture(s->texture);
+    SDL_DestroyRenderer(s->renderer);
+  }
   SDL_DestroyWindow(s->window);
-  SDL_DestroyRenderer(s->renderer);
 }
@@ -0,0 +1,284 @@
+// file: cairo-imgui-fastcheck.c
+// vim:fileencoding=utf-8:ft=c:tabstop=2
+// This is free and unencumbered software released into the public domain.
+//
+// Author: R.F. Smith <rsmith@xs4all.nl>
+// SPDX-License-Identifier: Unlicense
+// Created: 2026-10-18 15:02:37 +0200
+// Last modified: 2026-10-18T15:02:37+0200
+
+// Check that rectangles written directly into the surface are identical to
+// what Cairo draws. Random rectangles are drawn on two surfaces with the
+// same contents, once through the fast path and once by Cairo, under random
+// colors, offsets, line widths, line joins, dashes, miter limits,
+// transformations, clips, groups and operators. Also check when cached widget groups are redrawn.
+// The library is included so its static functions can be used.
+
+#include "cairo-imgui.c"
+
+#define CHECK_W 64
+#define CHECK_H 48
+#define CHECK_CASES 200000
+
+typedef struct {
+  GUI_rgb col;
+  double x, y, w, h;
+  bool stroke;
+  double lw;
+  cairo_line_join_t join;
+  bool dash;
+  double miter;
+  double tx, ty;            // Translation.
+  int clip;                 // 0: none, 1: rectangle, 2: two rectangles.
+  double clip_x, clip_y, clip_w, clip_h;
+  bool group;
+  cairo_operator_t op;
+  cairo_antialias_t aa;
+} Case;
+
+// Random value that is often a whole or half number.
+static double coord(int lo, int hi)
+{
+  double v = lo + rand() % (hi - lo + 1);
+  switch (rand() % 8) {
+    case 0:
+      return v + 0.5;
+    case 1:
+      return v + rand() / (double)RAND_MAX;
+    default:
+      return v;
+  }
+}
+
+static double component(void)
+{
+  switch (rand() % 4) {
+    case 0:
+      return (rand() % 3) / 2.0;
+    case 1:
+      return (rand() % 256) / 255.0;
+    default:
+      return rand() / (double)RAND_MAX;
+  }
+}
+
+static Case random_case(void)
+{
+  static const double widths[] = {1.0, 2.0, 3.0, 4.0, 1.5};
+  static const cairo_line_join_t joins[] = {
+    CAIRO_LINE_JOIN_MITER, CAIRO_LINE_JOIN_ROUND, CAIRO_LINE_JOIN_BEVEL
+  };
+  // Below, at and above the √2 that a right angle needs.
+  static const double miters[] = {10.0, 1.0, 1.41421356, 1.41421357, 2.0};
+  static const cairo_operator_t ops[] = {
+    CAIRO_OPERATOR_OVER, CAIRO_OPERATOR_SOURCE, CAIRO_OPERATOR_XOR,
+    CAIRO_OPERATOR_ADD, CAIRO_OPERATOR_DIFFERENCE
+  };
+  Case k = {0};
+  k.col = (GUI_rgb) {
+    component(), component(), component()
+  };
+  k.x = coord(-8, CHECK_W);
+  k.y = coord(-8, CHECK_H);
+  k.w = coord(0, 40);
+  k.h = coord(0, 40);
+  k.stroke = rand() % 2;
+  k.lw = widths[rand() % 5];
+  k.join = rand() % 3 ? CAIRO_LINE_JOIN_MITER : joins[rand() % 3];
+  k.dash = rand() % 8 == 0;
+  k.miter = rand() % 3 ? 10.0 : miters[rand() % 5];
+  k.tx = rand() % 4 ? 0.0 : coord(-4, 4);
+  k.ty = rand() % 4 ? 0.0 : coord(-4, 4);
+  k.clip = rand() % 3;
+  k.clip_x = coord(-4, CHECK_W / 2);
+  k.clip_y = coord(-4, CHECK_H / 2);
+  k.clip_w = coord(1, CHECK_W);
+  k.clip_h = coord(1, CHECK_H);
+  k.group = rand() % 8 == 0;
+  k.op = rand() % 3 ? CAIRO_OPERATOR_OVER : ops[rand() % 5];
+  k.aa = rand() % 4 ? CAIRO_ANTIALIAS_DEFAULT : CAIRO_ANTIALIAS_NONE;
+  return k;
+}
+
+static void setup(cairo_t *cr, const Case *k)
+{
+  cairo_translate(cr, k->tx, k->ty);
+  if (k->clip) {
+    cairo_rectangle(cr, k->clip_x, k->clip_y, k->clip_w, k->clip_h);
+    if (k->clip == 2) {
+      cairo_rectangle(cr, k->clip_x + k->clip_w / 2, k->clip_y + k->clip_h,
+                      k->clip_w, k->clip_h / 2 + 1);
+    }
+    cairo_clip(cr);
+  }
+  if (k->group) {
+    cairo_push_group(cr);
+  }
+  cairo_set_line_width(cr, k->lw);
+  cairo_set_line_join(cr, k->join);
+  cairo_set_miter_limit(cr, k->miter);
+  if (k->dash) {
+    static const double dashes[] = {3.0, 2.0};
+    cairo_set_dash(cr, dashes, 2, 0.0);
+  }
+  cairo_set_operator(cr, k->op);
+  cairo_set_antialias(cr, k->aa);
+}
+
+static void finish(cairo_t *cr, const Case *k)
+{
+  if (k->group) {
+    cairo_pop_group_to_source(cr);
+    cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+    cairo_paint(cr);
+  }
+}
+
+// Fill the surface with the same noise before every case, so that pixels
+// that should not be touched are checked too.
+static void noise(cairo_surface_t *s, uint32_t seed)
+{
+  cairo_surface_flush(s);
+  unsigned char *data = cairo_image_surface_get_data(s);
+  int stride = cairo_image_surface_get_stride(s);
+  for (int y = 0; y < CHECK_H; y++) {
+    uint32_t *row = (uint32_t *)(data + (size_t)y * stride);
+    for (int x = 0; x < CHECK_W; x++) {
+      seed = seed * 1664525u + 1013904223u;
+      row[x] = 0xff000000u | seed >> 8;
+    }
+  }
+  cairo_surface_mark_dirty(s);
+}
+
+static bool same(cairo_surface_t *a, cairo_surface_t *b)
+{
+  cairo_surface_flush(a);
+  cairo_surface_flush(b);
+  const unsigned char *da = cairo_image_surface_get_data(a);
+  const unsigned char *db = cairo_image_surface_get_data(b);
+  int stride = cairo_image_surface_get_stride(a);
+  for (int y = 0; y < CHECK_H; y++) {
+    if (memcmp(da + (size_t)y * stride, db + (size_t)y * stride,
+               CHECK_W * sizeof(uint32_t)) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static int check_rects(void)
+{
+  // The contexts are large, so they are not on the stack.
+  static GUI_context fast, slow;
+  cairo_surface_t *a = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+                       CHECK_W, CHECK_H);
+  cairo_surface_t *b = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+                       CHECK_W, CHECK_H);
+  srand(1);
+  long taken = 0, failed = 0;
+  for (long n = 0; n < CHECK_CASES; n++) {
+    Case k = random_case();
+    noise(a, n);
+    noise(b, n);
+    fast.ctx = cairo_create(a);
+    slow.ctx = cairo_create(b);
+    setup(fast.ctx, &k);
+    setup(slow.ctx, &k);
+    bool used = rect_fast(&fast, &k.col, k.x, k.y, k.w, k.h, k.stroke);
+    if (!used) {
+      rect_cairo(&fast, &k.col, k.x, k.y, k.w, k.h, k.stroke);
+    }
+    rect_cairo(&slow, &k.col, k.x, k.y, k.w, k.h, k.stroke);
+    finish(fast.ctx, &k);
+    finish(slow.ctx, &k);
+    cairo_destroy(fast.ctx);
+    cairo_destroy(slow.ctx);
+    taken += used;
+    if (used && !same(a, b)) {
+      if (failed++ < 10) {
+        printf("%s %g,%g %gx%g lw %g, join %d, dash %d, miter %.9g, "
+               "translate %g,%g, clip %d, color %g %g %g differs\n",
+               k.stroke ? "stroke" : "fill", k.x, k.y, k.w, k.h, k.lw,
+               (int)k.join, (int)k.dash, k.miter, k.tx, k.ty, k.clip,
+               k.col.r, k.col.g, k.col.b);
+      }
+    }
+  }
+  cairo_surface_destroy(a);
+  cairo_surface_destroy(b);
+  printf("%d cases, %ld through the fast path, %ld different.\n",
+         CHECK_CASES, taken, failed);
+  return failed ? 1 : 0;
+}
+
+// Run one frame with a group that holds a button, without a window.
+// Returns the mode of the group; the frame is left in pixels.
+static int group_frame(GUI_context *c, uint32_t *pixels)
+{
+  begin_frame(c, pixels, CHECK_W, CHECK_H, CHECK_W * sizeof(uint32_t));
+  if (gui_group_begin(c, 1, 0.0, 0.0, CHECK_W, CHECK_H, 0)) {
+    gui_button(c, 4.0, 4.0, "B");
+  }
+  int mode = c->groups[0].mode;
+  gui_group_end(c);
+  cairo_destroy(c->ctx);
+  cairo_surface_destroy(c->surface);
+  c->ctx = 0;
+  c->surface = 0;
+  c->maxid = c->counter;
+  c->button_released = false;
+  c->nevents = 0;
+  return mode;
+}
+
+// A widget in a group that keeps the focus after the mouse has left must be
+// drawn live, and the cache must be made again without its accent once the
+// focus moves out of the group.
+static int check_groups(void)
+{
+  static GUI_context c;
+  static uint32_t idle[CHECK_W * CHECK_H], frame[CHECK_W * CHECK_H];
+  gui_theme_dark(&c);
+  int failed = 0;
+  const int far = 10 * CHECK_W;
+  c.mouse_x = c.mouse_y = far;
+  if (group_frame(&c, idle) != GROUP_RECORD) {
+    failed++;
+    printf("group: first frame is not recorded\n");
+  }
+  // Hovering the button gives it the focus.
+  c.mouse_x = c.mouse_y = 8;
+  group_frame(&c, frame);
+  int32_t button = c.id;
+  c.mouse_x = c.mouse_y = far;
+  for (int k = 0; k < 3; k++) {
+    int mode = group_frame(&c, frame);
+    if (mode != GROUP_LIVE || c.id != button) {
+      failed++;
+      printf("group: focused widget not drawn live (mode %d)\n", mode);
+    }
+  }
+  // Focus leaves the group, as with Tab.
+  c.id = 0;
+  group_frame(&c, frame);
+  int mode = group_frame(&c, frame);
+  if (mode != GROUP_CACHED) {
+    failed++;
+    printf("group: not cached after the focus left (mode %d)\n", mode);
+  }
+  if (memcmp(idle, frame, sizeof(idle)) != 0) {
+    failed++;
+    printf("group: cache differs from the idle group\n");
+  }
+  gui_free(&c);
+  printf("group focus checks, %d failed.\n", failed);
+  return failed ? 1 : 0;
+}
+
+int main(void)
+{
+  int rv = check_rects();
+  rv |= check_groups();
+  return rv;
+}
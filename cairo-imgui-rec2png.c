@@ -0,0 +1,87 @@
+// file: cairo-imgui-rec2png.c
+// vim:fileencoding=utf-8:ft=c:tabstop=2
+// This is free and unencumbered software released into the public domain.
+//
+// Author: R.F. Smith <rsmith@xs4all.nl>
+// SPDX-License-Identifier: Unlicense
+// Created: 2026-10-18 11:30:04 +0200
+// Last modified: 2026-10-18T11:58:21+0200
+
+// Convert a recording made with gui_capture_start into PNG files.
+
+#include <cairo/cairo.h>
+
+#include "cairo-imgui.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main(int argc, char *argv[])
+{
+  if (argc < 2 || argc > 3) {
+    fprintf(stderr, "Usage: %s recording [prefix]\n", argv[0]);
+    return 1;
+  }
+  const char *prefix = argc == 3 ? argv[2] : "frame";
+  FILE *in = fopen(argv[1], "rb");
+  if (!in) {
+    fprintf(stderr, "Cannot open “%s”.\n", argv[1]);
+    return 1;
+  }
+  char magic[8];
+  if (fread(magic, 8, 1, in) != 1 || memcmp(magic, GUI_REC_MAGIC, 8) != 0) {
+    fprintf(stderr, "“%s” is not a recording.\n", argv[1]);
+    fclose(in);
+    return 1;
+  }
+  uint32_t *frame = 0;
+  uint32_t width = 0, height = 0;
+  GUI_rec_frame hdr;
+  int count = 0;
+  int rv = 0;
+  while (fread(&hdr, sizeof(hdr), 1, in) == 1) {
+    size_t npix = (size_t)hdr.width * hdr.height;
+    if (hdr.width != width || hdr.height != height) {
+      // A new size starts from an all-zero frame.
+      free(frame);
+      frame = calloc(npix ? npix : 1, sizeof(uint32_t));
+      if (!frame) {
+        fputs("Out of memory.\n", stderr);
+        rv = 1;
+        break;
+      }
+      width = hdr.width;
+      height = hdr.height;
+    }
+    for (uint32_t r = 0; r < hdr.nruns; r++) {
+      uint32_t run[2];
+      if (fread(run, sizeof(uint32_t), 2, in) != 2 ||
+          (size_t)run[0] + run[1] > npix ||
+          fread(frame + run[0], sizeof(uint32_t), run[1], in) != run[1]) {
+        fprintf(stderr, "Frame %d is damaged.\n", count);
+        rv = 1;
+        goto done;
+      }
+    }
+    char name[256];
+    snprintf(name, sizeof(name), "%s-%05d.png", prefix, count);
+    cairo_surface_t *surface = cairo_image_surface_create_for_data(
+                                 (unsigned char *)frame, CAIRO_FORMAT_ARGB32,
+                                 width, height, width * sizeof(uint32_t));
+    if (cairo_surface_write_to_png(surface, name) != CAIRO_STATUS_SUCCESS) {
+      fprintf(stderr, "Cannot write “%s”.\n", name);
+      rv = 1;
+    }
+    cairo_surface_destroy(surface);
+    if (rv) {
+      break;
+    }
+    count++;
+  }
+done:
+  printf("%d frames converted.\n", count);
+  free(frame);
+  fclose(in);
+  return rv;
+}
@@ -5,61 +5,1409 @@
 // Author: R.F. Smith <rsmith@xs4all.nl>
 // SPDX-License-Identifier: Unlicense
 // Created: 2025-08-26 14:04:09 +0200
-// Last modified: 2025-09-26T23:05:15+0200
+// Last modified: 2026-10-18T10:12:40+0200
 
 #include "cairo-imgui.h"
+#include <ctype.h>
 #include <math.h>
+#include <stdalign.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <cairo/cairo.h>
 #include <SDL3/SDL.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 static double m_width, m_height;
+// Height of the font, including descenders.
+static double f_height;
+
+// Measurement cache entry. Every widget takes the next slot each frame, so a
+// widget finds its own entry again in the next frame.
+typedef struct GUI_measure {
+  uint64_t hash;    // Hash of the measured string.
+  uint32_t serial;  // Font serial at the time of measurement.
+  cairo_text_extents_t ext;
+  double w, h;      // Size of the widget when last placed.
+} GUI_measure;
+
+uint64_t gui_hash(const char *s)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+  while (*s) {
+    h ^= (unsigned char)*s++;
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+// Key for data that a widget keeps in the state table. Different kinds of
+// data for the same widget are told apart by tag.
+static uint64_t widget_key(int32_t id, uint32_t tag)
+{
+  uint64_t h = ((uint64_t)tag << 32 | (uint32_t)id) * 0x9e3779b97f4a7c15ULL;
+  return h ? h : 1;
+}
+
+// Find the index of key in the state table, or the empty slot where it
+// should go. The table is never full.
+static int32_t state_find(const GUI_context *c, uint64_t key)
+{
+  uint32_t mask = c->state_cap - 1;
+  uint32_t k = (uint32_t)(key ^ key >> 29) * 0x9e3779b9u & mask;
+  while (c->state_keys[k] && c->state_keys[k] != key) {
+    k = (k + 1) & mask;
+  }
+  return k;
+}
+
+// Grow the state table to cap entries, which must be a power of two.
+static bool state_grow(GUI_context *c, int32_t cap)
+{
+  uint64_t *keys = calloc(cap, sizeof(uint64_t));
+  uint32_t *used = calloc(cap, sizeof(uint32_t));
+  void **data = calloc(cap, sizeof(void *));
+  if (!keys || !used || !data) {
+    free(keys);
+    free(used);
+    free(data);
+    return false;
+  }
+  GUI_context old = *c;
+  c->state_keys = keys;
+  c->state_used = used;
+  c->state_data = data;
+  c->state_cap = cap;
+  for (int32_t k = 0; k < old.state_cap; k++) {
+    if (old.state_keys[k]) {
+      int32_t j = state_find(c, old.state_keys[k]);
+      keys[j] = old.state_keys[k];
+      used[j] = old.state_used[k];
+      data[j] = old.state_data[k];
+    }
+  }
+  free(old.state_keys);
+  free(old.state_used);
+  free(old.state_data);
+  return true;
+}
+
+// Remove entry k, moving later entries of the same probe sequence back so
+// no tombstones are needed.
+static void state_remove(GUI_context *c, int32_t k)
+{
+  uint32_t mask = c->state_cap - 1;
+  free(c->state_data[k]);
+  c->state_count--;
+  uint32_t hole = k;
+  for (uint32_t j = (hole + 1) & mask; c->state_keys[j]; j = (j + 1) & mask) {
+    uint64_t key = c->state_keys[j];
+    uint32_t home = (uint32_t)(key ^ key >> 29) * 0x9e3779b9u & mask;
+    // Move the entry if the hole lies between its home and its slot.
+    if (((j - home) & mask) >= ((j - hole) & mask)) {
+      c->state_keys[hole] = key;
+      c->state_used[hole] = c->state_used[j];
+      c->state_data[hole] = c->state_data[j];
+      hole = j;
+    }
+  }
+  c->state_keys[hole] = 0;
+  c->state_data[hole] = 0;
+}
+
+void *gui_state(GUI_context *c, uint64_t key, size_t size, bool *isnew)
+{
+  assert(c);
+  assert(key);
+  if (isnew) {
+    *isnew = false;
+  }
+  // Keep the load factor below 0.7.
+  if (10 * (c->state_count + 1) > 7 * c->state_cap &&
+      !state_grow(c, c->state_cap ? 2 * c->state_cap : 64)) {
+    return 0;
+  }
+  int32_t k = state_find(c, key);
+  c->state_used[k] = (uint32_t)c->frame;
+  if (c->state_keys[k]) {
+    return c->state_data[k];
+  }
+  void *data = calloc(1, size ? size : 1);
+  if (!data) {
+    return 0;
+  }
+  c->state_keys[k] = key;
+  c->state_data[k] = data;
+  c->state_count++;
+  if (isnew) {
+    *isnew = true;
+  }
+  return data;
+}
+
+// Remove the entries that have not been used for state_ttl frames.
+// The table is only swept once every few frames.
+static void state_collect(GUI_context *c)
+{
+  uint32_t ttl = c->state_ttl ? c->state_ttl : 60;
+  if (c->state_count == 0 || c->frame % 16 != 0) {
+    return;
+  }
+  uint32_t now = (uint32_t)c->frame;
+  for (int32_t k = 0; k < c->state_cap; k++) {
+    // Removal can move another entry into slot k, so check it again.
+    while (c->state_keys[k] && now - c->state_used[k] > ttl) {
+      state_remove(c, k);
+    }
+  }
+}
+
+// Take the next measurement slot.
+static GUI_measure *gui_slot(GUI_context *c)
+{
+  // Used if the cache cannot grow; it never matches a hash.
+  static GUI_measure scratch;
+  if (c->slot >= c->nslots) {
+    int32_t newsize = c->nslots ? 2 * c->nslots : 64;
+    while (newsize <= c->slot) {
+      newsize *= 2;
+    }
+    GUI_measure *mc = realloc(c->mcache, newsize * sizeof(GUI_measure));
+    if (!mc) {
+      c->slot++;
+      scratch = (GUI_measure) {
+        0
+      };
+      return &scratch;
+    }
+    memset(mc + c->nslots, 0, (newsize - c->nslots) * sizeof(GUI_measure));
+    c->mcache = mc;
+    c->nslots = newsize;
+  }
+  return &c->mcache[c->slot++];
+}
+
+// Get the extents of a string, only measuring it when the string or the
+// font has changed since the slot was last used.
+static void gui_extents(GUI_context *c, GUI_measure *m, const char *s,
+                        cairo_text_extents_t *ext)
+{
+  uint64_t hash = gui_hash(s);
+  if (m->hash != hash || m->serial != c->font_serial) {
+    cairo_text_extents(c->ctx, s, &m->ext);
+    m->hash = hash;
+    m->serial = c->font_serial;
+  }
+  *ext = m->ext;
+}
+
+static void gui_placed(GUI_context *c, GUI_measure *m, double x, double y,
+                       double w, double h);
+
+// Returns true if the rectangle is completely outside the clip rectangle of
+// a scroll region. A negative width means that the width is not known.
+static bool gui_culled(const GUI_context *c, double x, double y, double w,
+                       double h)
+{
+  if (!c->clipping) {
+    return false;
+  }
+  // Leave room for line widths and text that extends beyond the box.
+  const double margin = f_height;
+  return y - margin > c->clip_y + c->clip_h || y + h + margin < c->clip_y ||
+         x - margin > c->clip_x + c->clip_w ||
+         (w >= 0.0 && x + w + margin < c->clip_x);
+}
+
+// Place a widget that was culled. It keeps the size it had when it was last
+// drawn, so a layout does not shift while scrolling.
+static void gui_skipped(GUI_context *c, GUI_measure *m, double x, double y,
+                        double w, double h)
+{
+  if (m->h > 0.0) {
+    w = m->w;
+    h = m->h;
+  }
+  gui_placed(c, m, x, y, w > 0.0 ? w : 0.0, h);
+}
+
+// Fill n pixels with the same value.
+static void fill_span(uint32_t *dst, int32_t n, uint32_t v)
+{
+  int32_t k = 0;
+#if defined(__AVX2__)
+  __m256i v8 = _mm256_set1_epi32((int)v);
+  for (; k + 8 <= n; k += 8) {
+    _mm256_storeu_si256((__m256i *)(dst + k), v8);
+  }
+#endif
+#if defined(__SSE2__)
+  __m128i v4 = _mm_set1_epi32((int)v);
+  for (; k + 4 <= n; k += 4) {
+    _mm_storeu_si128((__m128i *)(dst + k), v4);
+  }
+#elif defined(__ARM_NEON)
+  uint32x4_t v4 = vdupq_n_u32(v);
+  for (; k + 4 <= n; k += 4) {
+    vst1q_u32(dst + k, v4);
+  }
+#endif
+  for (; k < n; k++) {
+    dst[k] = v;
+  }
+}
+
+// Convert a color to a pixel the way Cairo does for opaque colors: each
+// component is rounded to 16 bits, of which the upper 8 are used.
+static uint32_t rgb_pixel(const GUI_rgb *col)
+{
+  uint32_t r = (uint16_t)(col->r * 65535.0 + 0.5) >> 8;
+  uint32_t g = (uint16_t)(col->g * 65535.0 + 0.5) >> 8;
+  uint32_t b = (uint16_t)(col->b * 65535.0 + 0.5) >> 8;
+  return 0xff000000u | r << 16 | g << 8 | b;
+}
+
+static bool integral(double v)
+{
+  return v == floor(v);
+}
+
+// Draw a rectangle directly into the pixels of the target surface.
+// This only works when the rectangle falls exactly on pixel boundaries, so
+// that Cairo would not anti-alias it either. Returns false without drawing
+// anything if that is not the case.
+static bool rect_fast(GUI_context *c, const GUI_rgb *col, double x, double y,
+                      double w, double h, bool stroke)
+{
+  // Inside cairo_push_group, drawing goes to an intermediate surface.
+  cairo_surface_t *target = cairo_get_target(c->ctx);
+  if (cairo_get_group_target(c->ctx) != target ||
+      cairo_surface_get_type(target) != CAIRO_SURFACE_TYPE_IMAGE ||
+      cairo_image_surface_get_format(target) != CAIRO_FORMAT_ARGB32) {
+    return false;
+  }
+  // With an opaque source, only these operators replace the pixels.
+  cairo_operator_t op = cairo_get_operator(c->ctx);
+  if (op != CAIRO_OPERATOR_OVER && op != CAIRO_OPERATOR_SOURCE) {
+    return false;
+  }
+  // Only integer translations keep pixel alignment.
+  cairo_matrix_t m;
+  cairo_get_matrix(c->ctx, &m);
+  if (m.xx != 1.0 || m.yy != 1.0 || m.xy != 0.0 || m.yx != 0.0 ||
+      !integral(m.x0) || !integral(m.y0)) {
+    return false;
+  }
+  // The clip has to be a single rectangle.
+  cairo_rectangle_list_t *clip = cairo_copy_clip_rectangle_list(c->ctx);
+  bool simple = clip->status == CAIRO_STATUS_SUCCESS &&
+                clip->num_rectangles == 1;
+  double cx0 = 0.0, cy0 = 0.0, cx1 = 0.0, cy1 = 0.0;
+  if (simple) {
+    cx0 = clip->rectangles[0].x;
+    cy0 = clip->rectangles[0].y;
+    cx1 = cx0 + clip->rectangles[0].width;
+    cy1 = cy0 + clip->rectangles[0].height;
+  }
+  cairo_rectangle_list_destroy(clip);
+  if (!simple || !integral(cx0) || !integral(cy0) || !integral(cx1) || !integral(cy1) ||
+      !integral(x) || !integral(y) || !integral(w) || !integral(h) ||
+      w <= 0.0 || h <= 0.0) {
+    return false;
+  }
+  // A rectangle to fill is described as x0, y0, x1, y1.
+  double boxes[4][4];
+  int nboxes;
+  if (stroke) {
+    // The stroke is centered on the outline; it has to cover whole pixels
+    // and leave an inside.
+    double lw = cairo_get_line_width(c->ctx);
+    double half = lw / 2;
+    if (!integral(lw) || !integral(x - half) || w <= lw || h <= lw) {
+      return false;
+    }
+    // Square corners need mitered joins; Cairo bevels a right angle when
+    // the miter limit is below √2, the same test it uses.
+    double ml = cairo_get_miter_limit(c->ctx);
+    if (cairo_get_line_join(c->ctx) != CAIRO_LINE_JOIN_MITER ||
+        cairo_get_dash_count(c->ctx) != 0 || ml * ml < 2.0) {
+      return false;
+    }
+    double ox0 = x - half, oy0 = y - half;
+    double ox1 = x + w + half, oy1 = y + h + half;
+    double ix0 = x + half, iy0 = y + half;
+    double ix1 = x + w - half, iy1 = y + h - half;
+    double b[4][4] = {
+      {ox0, oy0, ox1, iy0}, // top
+      {ox0, iy1, ox1, oy1}, // bottom
+      {ox0, iy0, ix0, iy1}, // left
+      {ix1, iy0, ox1, iy1}  // right
+    };
+    memcpy(boxes, b, sizeof(b));
+    nboxes = 4;
+  } else {
+    boxes[0][0] = x;
+    boxes[0][1] = y;
+    boxes[0][2] = x + w;
+    boxes[0][3] = y + h;
+    nboxes = 1;
+  }
+  cairo_new_path(c->ctx);
+  cairo_set_source_rgb(c->ctx, col->r, col->g, col->b);
+  cairo_surface_flush(target);
+  unsigned char *data = cairo_image_surface_get_data(target);
+  int stride = cairo_image_surface_get_stride(target);
+  int sw = cairo_image_surface_get_width(target);
+  int sh = cairo_image_surface_get_height(target);
+  uint32_t pixel = rgb_pixel(col);
+  for (int k = 0; k < nboxes; k++) {
+    // Clip, and convert to device coordinates.
+    int32_t x0 = fmax(boxes[k][0], cx0) + m.x0;
+    int32_t y0 = fmax(boxes[k][1], cy0) + m.y0;
+    int32_t x1 = fmin(boxes[k][2], cx1) + m.x0;
+    int32_t y1 = fmin(boxes[k][3], cy1) + m.y0;
+    x0 = x0 < 0 ? 0 : x0;
+    y0 = y0 < 0 ? 0 : y0;
+    x1 = x1 > sw ? sw : x1;
+    y1 = y1 > sh ? sh : y1;
+    if (x1 <= x0 || y1 <= y0) {
+      continue;
+    }
+    for (int32_t row = y0; row < y1; row++) {
+      fill_span((uint32_t *)(data + (size_t)row * stride) + x0, x1 - x0, pixel);
+    }
+    cairo_surface_mark_dirty_rectangle(target, x0, y0, x1 - x0, y1 - y0);
+  }
+  return true;
+}
+
+static void rect_cairo(GUI_context *c, const GUI_rgb *col, double x, double y,
+                       double w, double h, bool stroke)
+{
+  cairo_new_path(c->ctx);
+  cairo_set_source_rgb(c->ctx, col->r, col->g, col->b);
+  cairo_rectangle(c->ctx, x, y, w, h);
+  if (stroke) {
+    cairo_stroke(c->ctx);
+  } else {
+    cairo_fill(c->ctx);
+  }
+}
+
+#ifdef GUI_VERIFY_FASTPATH
+// Draw the rectangle both ways, and complain if the pixels differ.
+static void rect_verify(GUI_context *c, const GUI_rgb *col, double x, double y,
+                        double w, double h, bool stroke)
+{
+  cairo_surface_t *target = cairo_get_target(c->ctx);
+  cairo_surface_flush(target);
+  unsigned char *data = cairo_image_surface_get_data(target);
+  size_t size = (size_t)cairo_image_surface_get_stride(target) *
+                cairo_image_surface_get_height(target);
+  unsigned char *before = malloc(size);
+  unsigned char *fast = malloc(size);
+  if (!data || !before || !fast) {
+    free(before);
+    free(fast);
+    rect_cairo(c, col, x, y, w, h, stroke);
+    return;
+  }
+  memcpy(before, data, size);
+  if (rect_fast(c, col, x, y, w, h, stroke)) {
+    cairo_surface_flush(target);
+    memcpy(fast, data, size);
+    memcpy(data, before, size);
+    cairo_surface_mark_dirty(target);
+    rect_cairo(c, col, x, y, w, h, stroke);
+    cairo_surface_flush(target);
+    if (memcmp(fast, data, size) != 0) {
+      SDL_Log("fast %s of %g,%g %gx%g differs from cairo",
+              stroke ? "stroke" : "fill", x, y, w, h);
+    }
+  } else {
+    rect_cairo(c, col, x, y, w, h, stroke);
+  }
+  free(before);
+  free(fast);
+}
+#endif
+
+// Fill or stroke a rectangle with an opaque color. Pixel-aligned
+// rectangles are written into the surface directly; others are left to
+// Cairo.
+static void gui_rect_fill(GUI_context *c, const GUI_rgb *col, double x,
+                          double y, double w, double h)
+{
+#ifdef GUI_VERIFY_FASTPATH
+  rect_verify(c, col, x, y, w, h, false);
+#else
+  if (!rect_fast(c, col, x, y, w, h, false)) {
+    rect_cairo(c, col, x, y, w, h, false);
+  }
+#endif
+}
+
+static void gui_rect_stroke(GUI_context *c, const GUI_rgb *col, double x,
+                            double y, double w, double h)
+{
+#ifdef GUI_VERIFY_FASTPATH
+  rect_verify(c, col, x, y, w, h, true);
+#else
+  if (!rect_fast(c, col, x, y, w, h, true)) {
+    rect_cairo(c, col, x, y, w, h, true);
+  }
+#endif
+}
+
+// Accent outline of a widget that has the mouse or the focus. It is only
+// decoration, so it is left out at the lowest quality.
+static void gui_accent(GUI_context *c, double x, double y, double w, double h)
+{
+  if (c->quality < GUI_QUALITY_NO_ACCENTS) {
+    gui_rect_stroke(c, &c->acc, x, y, w, h);
+  }
+}
+
+// Set up a cairo context for the current quality level.
+static void apply_quality(const GUI_context *c, cairo_t *cr)
+{
+  if (c->quality >= GUI_QUALITY_NO_AA) {
+    cairo_set_antialias(cr, CAIRO_ANTIALIAS_NONE);
+  }
+  if (c->quality >= GUI_QUALITY_NO_HINTING) {
+    cairo_font_options_t *fo = cairo_font_options_create();
+    cairo_font_options_set_antialias(fo, CAIRO_ANTIALIAS_NONE);
+    cairo_font_options_set_hint_style(fo, CAIRO_HINT_STYLE_NONE);
+    cairo_font_options_set_hint_metrics(fo, CAIRO_HINT_METRICS_OFF);
+    cairo_set_font_options(cr, fo);
+    cairo_font_options_destroy(fo);
+  }
+}
+
+// Change the quality level depending on the duration of the last frame.
+// Quality goes down after a few frames over budget, and only goes up again
+// after many frames with room to spare, so it does not flip every frame.
+static void govern_quality(GUI_context *c)
+{
+  int32_t level = c->quality;
+  if (c->budget_ms <= 0.0) {
+    level = GUI_QUALITY_FULL;
+  } else if (c->frame_ms > c->budget_ms) {
+    c->under = 0;
+    if (++c->over >= 3 && level < GUI_QUALITY_NO_ACCENTS) {
+      level++;
+    }
+  } else if (c->frame_ms < 0.6 * c->budget_ms) {
+    c->over = 0;
+    if (++c->under >= 30 && level > GUI_QUALITY_FULL) {
+      level--;
+    }
+  } else {
+    c->over = c->under = 0;
+  }
+  if (level == c->quality) {
+    return;
+  }
+  SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION,
+               "frame took %.2f ms; quality level %d -> %d",
+               c->frame_ms, c->quality, level);
+  if (level > c->quality) {
+    c->quality_down++;
+  } else {
+    c->quality_up++;
+  }
+  // Text is measured differently without hinting.
+  if ((level >= GUI_QUALITY_NO_HINTING) !=
+      (c->quality >= GUI_QUALITY_NO_HINTING)) {
+    c->font_serial++;
+  }
+  c->quality = level;
+  c->over = c->under = 0;
+}
+
+// Frame capture. Finished frames are copied into a ring of buffers by the
+// GUI thread, and written to disk by a separate thread.
+typedef struct {
+  uint32_t *pixels;
+  size_t size;      // Allocated number of pixels.
+  uint32_t width, height;
+  uint64_t timestamp;
+} GUI_capframe;
+
+struct GUI_capture {
+  FILE *out;
+  SDL_Thread *thread;
+  SDL_Semaphore *ready;
+  atomic_bool stop;
+  atomic_size_t head;  // Next buffer to be filled by the GUI thread.
+  atomic_size_t tail;  // Next buffer to be written.
+  atomic_uint_fast64_t written;
+  uint64_t dropped;
+  size_t nframes;
+  GUI_capframe *frames;
+  // Only used by the writer.
+  uint32_t *prev;
+  uint32_t prev_w, prev_h;
+  uint32_t *runs;
+  bool failed;
+};
+
+// Pixels that are the same in both frames, but lie between changed pixels
+// closer together than this, are written anyway; a run costs 8 bytes.
+#define CAPTURE_GAP 4
+
+// Write one frame as runs of pixels that changed since the previous frame.
+static bool capture_write(GUI_capture *cap, const GUI_capframe *f)
+{
+  size_t npix = (size_t)f->width * f->height;
+  if (f->width != cap->prev_w || f->height != cap->prev_h) {
+    // A new size starts from a black frame, for the writer and the reader.
+    free(cap->prev);
+    free(cap->runs);
+    cap->prev = calloc(npix ? npix : 1, sizeof(uint32_t));
+    // Worst case: every other pixel starts a run.
+    cap->runs = malloc((npix / 2 + 1) * 2 * sizeof(uint32_t));
+    if (!cap->prev || !cap->runs) {
+      cap->prev_w = cap->prev_h = 0;
+      return false;
+    }
+    cap->prev_w = f->width;
+    cap->prev_h = f->height;
+  }
+  // Find the runs.
+  uint32_t nruns = 0;
+  size_t k = 0;
+  while (k < npix) {
+    if (f->pixels[k] == cap->prev[k]) {
+      k++;
+      continue;
+    }
+    size_t start = k, end = k + 1, same = 0;
+    for (k = end; k < npix; k++) {
+      if (f->pixels[k] != cap->prev[k]) {
+        end = k + 1;
+        same = 0;
+      } else if (++same > CAPTURE_GAP) {
+        break;
+      }
+    }
+    cap->runs[2*nruns] = start;
+    cap->runs[2*nruns + 1] = end - start;
+    nruns++;
+    k = end;
+  }
+  GUI_rec_frame hdr = {f->timestamp, f->width, f->height, nruns, 0};
+  if (fwrite(&hdr, sizeof(hdr), 1, cap->out) != 1) {
+    return false;
+  }
+  for (uint32_t r = 0; r < nruns; r++) {
+    uint32_t start = cap->runs[2*r], count = cap->runs[2*r + 1];
+    if (fwrite(&cap->runs[2*r], sizeof(uint32_t), 2, cap->out) != 2 ||
+        fwrite(f->pixels + start, sizeof(uint32_t), count, cap->out) != count) {
+      return false;
+    }
+  }
+  memcpy(cap->prev, f->pixels, npix * sizeof(uint32_t));
+  return true;
+}
+
+static int capture_thread(void *data)
+{
+  GUI_capture *cap = data;
+  for (;;) {
+    SDL_WaitSemaphore(cap->ready);
+    size_t tail = atomic_load_explicit(&cap->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&cap->head, memory_order_acquire);
+    while (tail != head) {
+      GUI_capframe *f = &cap->frames[tail % cap->nframes];
+      if (!cap->failed && !capture_write(cap, f)) {
+        SDL_Log("Writing the capture failed; frames are discarded.");
+        cap->failed = true;
+      }
+      if (!cap->failed) {
+        atomic_fetch_add_explicit(&cap->written, 1, memory_order_relaxed);
+      }
+      atomic_store_explicit(&cap->tail, ++tail, memory_order_release);
+    }
+    if (atomic_load(&cap->stop)) {
+      break;
+    }
+  }
+  return 0;
+}
+
+// Hand a copy of the finished frame to the writer. This never waits; when
+// all buffers are still in use, the frame is dropped.
+static void capture_frame(GUI_context *ctx)
+{
+  GUI_capture *cap = ctx->capture;
+  size_t head = atomic_load_explicit(&cap->head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&cap->tail, memory_order_acquire);
+  if (head - tail >= cap->nframes) {
+    cap->dropped++;
+    return;
+  }
+  GUI_capframe *f = &cap->frames[head % cap->nframes];
+  cairo_surface_flush(ctx->surface);
+  int w = cairo_image_surface_get_width(ctx->surface);
+  int h = cairo_image_surface_get_height(ctx->surface);
+  int stride = cairo_image_surface_get_stride(ctx->surface);
+  const unsigned char *data = cairo_image_surface_get_data(ctx->surface);
+  size_t npix = (size_t)w * h;
+  if (f->size < npix) {
+    // Only happens for the first frames, or when the window grows.
+    uint32_t *p = realloc(f->pixels, npix * sizeof(uint32_t));
+    if (!p) {
+      cap->dropped++;
+      return;
+    }
+    f->pixels = p;
+    f->size = npix;
+  }
+  for (int y = 0; y < h; y++) {
+    memcpy(f->pixels + (size_t)y * w, data + (size_t)y * stride,
+           w * sizeof(uint32_t));
+  }
+  f->width = w;
+  f->height = h;
+  f->timestamp = SDL_GetTicksNS();
+  atomic_store_explicit(&cap->head, head + 1, memory_order_release);
+  SDL_SignalSemaphore(cap->ready);
+}
+
+bool gui_capture_start(GUI_context *c, const char *path, int32_t nbuffers)
+{
+  assert(c);
+  assert(path);
+  assert(!c->capture);
+  GUI_capture *cap = calloc(1, sizeof(GUI_capture));
+  if (!cap) {
+    return false;
+  }
+  cap->nframes = nbuffers > 0 ? nbuffers : 4;
+  cap->frames = calloc(cap->nframes, sizeof(GUI_capframe));
+  cap->out = fopen(path, "wb");
+  cap->ready = SDL_CreateSemaphore(0);
+  atomic_init(&cap->stop, false);
+  atomic_init(&cap->head, 0);
+  atomic_init(&cap->tail, 0);
+  atomic_init(&cap->written, 0);
+  if (cap->frames && cap->out && cap->ready &&
+      fwrite(GUI_REC_MAGIC, 8, 1, cap->out) == 1) {
+    cap->thread = SDL_CreateThread(capture_thread, "gui_capture", cap);
+  }
+  if (!cap->thread) {
+    if (cap->out) {
+      fclose(cap->out);
+    }
+    if (cap->ready) {
+      SDL_DestroySemaphore(cap->ready);
+    }
+    free(cap->frames);
+    free(cap);
+    return false;
+  }
+  c->capture = cap;
+  return true;
+}
+
+void gui_capture_stop(GUI_context *c)
+{
+  assert(c);
+  GUI_capture *cap = c->capture;
+  if (!cap) {
+    return;
+  }
+  // The writer finishes the frames it has before it stops.
+  atomic_store(&cap->stop, true);
+  SDL_SignalSemaphore(cap->ready);
+  SDL_WaitThread(cap->thread, 0);
+  fclose(cap->out);
+  SDL_DestroySemaphore(cap->ready);
+  for (size_t k = 0; k < cap->nframes; k++) {
+    free(cap->frames[k].pixels);
+  }
+  free(cap->frames);
+  free(cap->prev);
+  free(cap->runs);
+  c->capture_written = atomic_load(&cap->written);
+  c->capture_dropped = cap->dropped;
+  free(cap);
+  c->capture = 0;
+}
+
+void gui_capture_stats(const GUI_context *c, uint64_t *written,
+                       uint64_t *dropped)
+{
+  assert(c);
+  if (c->capture) {
+    GUI_capture *cap = c->capture;
+    *written = atomic_load_explicit(&cap->written, memory_order_relaxed);
+    *dropped = cap->dropped;
+  } else {
+    // Totals of the last capture.
+    *written = c->capture_written;
+    *dropped = c->capture_dropped;
+  }
+}
+
+// Messages in a queue.
+#define GUI_MSG_VALUE 1
+#define GUI_MSG_TEXT 2
+typedef struct {
+  int32_t kind;
+  int32_t index;
+  double value;
+  char text[GUI_LOG_WIDTH];
+} GUI_msg;
+
+// Each cell has a sequence number that tells whether it is free for the
+// producer at position pos (seq == pos) or filled for the consumer
+// (seq == pos + 1). This is D. Vyukov's bounded queue, with a single
+// consumer: the GUI thread.
+typedef struct {
+  atomic_size_t seq;
+  GUI_msg msg;
+} GUI_cell;
+
+struct GUI_queue {
+  // Head and tail are on separate cache lines, so producers and the
+  // consumer do not slow each other down.
+  alignas(64) atomic_size_t head;
+  alignas(64) atomic_size_t tail;
+  alignas(64) atomic_size_t dropped;
+  size_t mask;
+  bool multi;
+  GUI_cell *cells;
+};
+
+GUI_queue *gui_queue_create(size_t capacity, bool multi)
+{
+  size_t size = 2;
+  while (size < capacity) {
+    size *= 2;
+  }
+  size_t qsize = (sizeof(GUI_queue) + 63) / 64 * 64;
+  GUI_queue *q = aligned_alloc(64, qsize);
+  if (!q) {
+    return 0;
+  }
+  q->cells = malloc(size * sizeof(GUI_cell));
+  if (!q->cells) {
+    free(q);
+    return 0;
+  }
+  for (size_t k = 0; k < size; k++) {
+    atomic_init(&q->cells[k].seq, k);
+  }
+  atomic_init(&q->head, 0);
+  atomic_init(&q->tail, 0);
+  atomic_init(&q->dropped, 0);
+  q->mask = size - 1;
+  q->multi = multi;
+  return q;
+}
+
+void gui_queue_destroy(GUI_queue *q)
+{
+  if (q) {
+    free(q->cells);
+    free(q);
+  }
+}
+
+static bool queue_push(GUI_queue *q, const GUI_msg *msg)
+{
+  size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+  GUI_cell *cell;
+  for (;;) {
+    cell = &q->cells[pos & q->mask];
+    size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+    intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+    if (diff < 0) {
+      // The consumer has not emptied this cell yet; the queue is full.
+      atomic_fetch_add_explicit(&q->dropped, 1, memory_order_relaxed);
+      return false;
+    }
+    if (diff == 0) {
+      if (!q->multi) {
+        atomic_store_explicit(&q->head, pos + 1, memory_order_relaxed);
+        break;
+      }
+      if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1,
+          memory_order_relaxed, memory_order_relaxed)) {
+        break;
+      }
+    } else {
+      // Another producer claimed this cell.
+      pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    }
+  }
+  cell->msg = *msg;
+  atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+  return true;
+}
+
+static bool queue_pop(GUI_queue *q, GUI_msg *msg)
+{
+  size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+  GUI_cell *cell = &q->cells[pos & q->mask];
+  size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+  if (seq != pos + 1) {
+    return false;
+  }
+  *msg = cell->msg;
+  atomic_store_explicit(&cell->seq, pos + q->mask + 1, memory_order_release);
+  atomic_store_explicit(&q->tail, pos + 1, memory_order_relaxed);
+  return true;
+}
+
+bool gui_queue_push_value(GUI_queue *q, int32_t index, double value)
+{
+  assert(q);
+  GUI_msg msg = {.kind = GUI_MSG_VALUE, .index = index, .value = value};
+  return queue_push(q, &msg);
+}
+
+bool gui_queue_push_text(GUI_queue *q, const char *text)
+{
+  assert(q);
+  assert(text);
+  GUI_msg msg = {.kind = GUI_MSG_TEXT};
+  strncpy(msg.text, text, GUI_LOG_WIDTH - 1);
+  return queue_push(q, &msg);
+}
+
+size_t gui_queue_dropped(GUI_queue *q)
+{
+  assert(q);
+  return atomic_load_explicit(&q->dropped, memory_order_relaxed);
+}
+
+bool gui_queue_attach(GUI_context *c, GUI_queue *q, double *values,
+                      int32_t nvalues, GUI_log *log)
+{
+  assert(c);
+  assert(q);
+  for (int k = 0; k < GUI_MAX_FEEDS; k++) {
+    if (!c->feeds[k].queue) {
+      c->feeds[k] = (GUI_feed) {
+        q, values, values ? nvalues : 0, log
+      };
+      return true;
+    }
+  }
+  return false;
+}
+
+void gui_queue_detach(GUI_context *c, GUI_queue *q)
+{
+  assert(c);
+  for (int k = 0; k < GUI_MAX_FEEDS; k++) {
+    if (c->feeds[k].queue == q) {
+      c->feeds[k] = (GUI_feed) {
+        0
+      };
+    }
+  }
+}
+
+const char *gui_log_line(const GUI_log *log, int32_t k)
+{
+  assert(log);
+  if (k < 0 || k >= log->count) {
+    return 0;
+  }
+  return log->lines[(log->first + k) % GUI_LOG_LINES];
+}
+
+// Move everything that is in a queue now into the widget-visible state.
+// Messages pushed while draining are left for the next frame.
+static void queue_drain(GUI_feed *f)
+{
+  size_t n = atomic_load_explicit(&f->queue->head, memory_order_relaxed) -
+             atomic_load_explicit(&f->queue->tail, memory_order_relaxed);
+  GUI_msg msg;
+  while (n-- > 0 && queue_pop(f->queue, &msg)) {
+    if (msg.kind == GUI_MSG_VALUE) {
+      if (msg.index >= 0 && msg.index < f->nvalues) {
+        f->values[msg.index] = msg.value;
+      }
+    } else if (msg.kind == GUI_MSG_TEXT && f->log) {
+      GUI_log *log = f->log;
+      int32_t line;
+      if (log->count < GUI_LOG_LINES) {
+        line = (log->first + log->count++) % GUI_LOG_LINES;
+      } else {
+        // Overwrite the oldest line.
+        line = log->first;
+        log->first = (log->first + 1) % GUI_LOG_LINES;
+      }
+      memcpy(log->lines[line], msg.text, GUI_LOG_WIDTH);
+    }
+  }
+}
+
+// Move the pending input into this frame's events, and update the mouse
+// and key state from it. At most one button release is taken per frame,
+// so that every click is seen by the widgets; the rest of the input waits
+// for the next frame, in order.
+static void input_take(GUI_context *ctx)
+{
+  int32_t n = 0;
+  while (n < ctx->npending) {
+    if (ctx->pending[n++].type == GUI_INPUT_BUTTON_UP) {
+      break;
+    }
+  }
+  memcpy(ctx->events, ctx->pending, n * sizeof(GUI_input));
+  ctx->nevents = n;
+  ctx->npending -= n;
+  memmove(ctx->pending, ctx->pending + n, ctx->npending * sizeof(GUI_input));
+  ctx->mouse_dx = ctx->mouse_dy = 0.0f;
+  for (int32_t k = 0; k < n; k++) {
+    const GUI_input *in = &ctx->events[k];
+    switch (in->type) {
+      case GUI_INPUT_MOTION:
+        ctx->mouse_x = in->x;
+        ctx->mouse_y = in->y;
+        ctx->mouse_dx += in->dx;
+        ctx->mouse_dy += in->dy;
+        break;
+      case GUI_INPUT_BUTTON_DOWN:
+        ctx->mouse_x = in->x;
+        ctx->mouse_y = in->y;
+        ctx->button = in->button;
+        ctx->button_pressed = true;
+        ctx->button_released = false;
+        break;
+      case GUI_INPUT_BUTTON_UP:
+        ctx->mouse_x = in->x;
+        ctx->mouse_y = in->y;
+        ctx->button_pressed = false;
+        ctx->button_released = true;
+        break;
+      case GUI_INPUT_WHEEL:
+        ctx->wheel += in->dy;
+        break;
+      case GUI_INPUT_KEY:
+        if (in->key == SDLK_TAB) {
+          if (in->mod & (SDL_KMOD_LSHIFT|SDL_KMOD_RSHIFT)) {
+            ctx->id--;
+            if (ctx->id < 0) {
+              ctx->id = ctx->maxid;
+            }
+          } else {
+            ctx->id++;
+            if (ctx->id > ctx->maxid) {
+              ctx->id = 1;
+            }
+          }
+        } else {
+          // The last key, for code that handles one key per frame.
+          ctx->keycode = in->key;
+          ctx->mod = in->mod;
+        }
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+// Start a frame on pixels that are owned by the backend.
+static void begin_frame(GUI_context *out, void *pixels, int w, int h,
+                        int pitch)
+{
+  out->surface = cairo_image_surface_create_for_data(
+                   (char unsigned*)pixels, CAIRO_FORMAT_ARGB32, w, h, pitch);
+  // Create cairo context to draw on the surface.
+  out->ctx = cairo_create(out->surface);
+  apply_quality(out, out->ctx);
+  // Set color to background, fill the surface)
+  gui_rect_fill(out, &out->bg, 0, 0, w, h);
+  // Set font size. Cached measurements are invalid when it changes.
+  double fsize = out->font_size > 0.0 ? out->font_size : 14.0;
+  if (fsize != out->font_used) {
+    out->font_used = fsize;
+    out->font_serial++;
+  }
+  cairo_set_font_size(out->ctx, fsize);
+  // Determine the size of a capital M.
+  cairo_text_extents_t ext;
+  cairo_text_extents(out->ctx, "M", &ext);
+  m_width = ext.width;
+  m_height = ext.height;
+  cairo_font_extents_t fext;
+  cairo_font_extents(out->ctx, &fext);
+  f_height = fext.ascent + fext.descent;
+  // Pick up data from worker threads.
+  for (int k = 0; k < GUI_MAX_FEEDS; k++) {
+    if (out->feeds[k].queue) {
+      queue_drain(&out->feeds[k]);
+    }
+  }
+  out->counter = 1;
+  out->slot = 0;
+  out->layout = 0;
+  out->group = 0;
+  out->frame++;
+  // This frame consumes the input that arrived since the last one.
+  input_take(out);
+  // Hide the mouse from the widgets under an open drop-down.
+  out->popup = out->popup_next;
+  out->popup_next = (GUI_rect) {
+    0
+  };
+  out->popup_hit = out->popup.w > 0.0 &&
+                   out->mouse_x >= out->popup.x &&
+                   out->mouse_x - out->popup.x <= out->popup.w &&
+                   out->mouse_y >= out->popup.y &&
+                   out->mouse_y - out->popup.y <= out->popup.h;
+  if (out->popup_hit) {
+    out->popup_mouse_x = out->mouse_x;
+    out->popup_mouse_y = out->mouse_y;
+    out->popup_pressed = out->button_pressed;
+    out->popup_released = out->button_released;
+    out->popup_wheel = out->wheel;
+    out->mouse_x = out->mouse_y = INT32_MIN/2;
+    out->button_pressed = out->button_released = false;
+    out->wheel = 0.0f;
+  }
+}
 
 void gui_begin(SDL_Renderer *renderer, SDL_Texture *texture, GUI_context *out)
 {
   assert(renderer);
   assert(texture);
   assert(out);
+  out->frame_start = SDL_GetPerformanceCounter();
+  out->lat_begin = SDL_GetTicksNS();
   void *pixels;
   int pitch;
   int w, h;
   out->renderer = renderer;
   out->texture = texture;
+  out->window = 0;
   SDL_GetCurrentRenderOutputSize(renderer, &w, &h);
   // Create cairo surface which maps to the SDL texture.
   SDL_LockTexture(texture, 0, &pixels, &pitch);
-  out->surface = cairo_image_surface_create_for_data(
-                   (char unsigned*)pixels, CAIRO_FORMAT_ARGB32, w, h, pitch);
-  // Create cairo context to draw on the surface.
-  out->ctx = cairo_create(out->surface);
-  // Set color to background, fill the surface)
-  cairo_set_source_rgb(out->ctx, out->bg.r, out->bg.g, out->bg.b);
-  cairo_paint(out->ctx);
-  // Set font size
-  cairo_set_font_size(out->ctx, 14.0);
-  // Determine the size of a capital M.
-  cairo_text_extents_t ext;
-  cairo_text_extents(out->ctx, "M", &ext);
-  m_width = ext.width;
-  m_height = ext.height;
-  out->counter = 1;
+  begin_frame(out, pixels, w, h, pitch);
+}
+
+void gui_begin_window(SDL_Window *window, GUI_context *out)
+{
+  assert(window);
+  assert(out);
+  out->frame_start = SDL_GetPerformanceCounter();
+  out->lat_begin = SDL_GetTicksNS();
+  out->renderer = 0;
+  out->texture = 0;
+  out->window = window;
+  SDL_Surface *ws = SDL_GetWindowSurface(window);
+  assert(ws);
+  if (SDL_MUSTLOCK(ws)) {
+    SDL_LockSurface(ws);
+  }
+  if (ws->format == SDL_PIXELFORMAT_ARGB8888 ||
+      ws->format == SDL_PIXELFORMAT_XRGB8888) {
+    // Cairo can draw on these directly; the alpha byte is ignored.
+    if (out->shadow) {
+      SDL_DestroySurface(out->shadow);
+      out->shadow = 0;
+    }
+    begin_frame(out, ws->pixels, ws->w, ws->h, ws->pitch);
+    return;
+  }
+  // Otherwise draw on a surface of our own, and convert what has changed.
+  if (out->shadow && (out->shadow->w != ws->w || out->shadow->h != ws->h)) {
+    SDL_DestroySurface(out->shadow);
+    out->shadow = 0;
+  }
+  if (!out->shadow) {
+    out->shadow = SDL_CreateSurface(ws->w, ws->h, SDL_PIXELFORMAT_ARGB8888);
+    assert(out->shadow);
+  }
+  begin_frame(out, out->shadow->pixels, ws->w, ws->h, out->shadow->pitch);
+}
+
+// Compare one tile with the last presented frame, and copy it there if it
+// changed. memcmp is vectorised and stops at the first difference, so this
+// costs less than hashing every pixel.
+static bool tile_changed(const SDL_Surface *src, uint32_t *last, int x0,
+                         int y0, int x1, int y1)
+{
+  const unsigned char *data = src->pixels;
+  size_t len = (size_t)(x1 - x0) * sizeof(uint32_t);
+  int y = y0;
+  while (y < y1 && memcmp(data + (size_t)y * src->pitch + x0 * 4,
+                          last + (size_t)y * src->w + x0, len) == 0) {
+    y++;
+  }
+  if (y == y1) {
+    return false;
+  }
+  // Rows before y are the same already.
+  for (; y < y1; y++) {
+    memcpy(last + (size_t)y * src->w + x0,
+           data + (size_t)y * src->pitch + x0 * 4, len);
+  }
+  return true;
+}
+
+// Find the parts of the window surface that differ from the previous frame,
+// and copy them from the shadow surface if there is one. Returns the number
+// of rectangles in ctx->damage, or -1 if the whole window should be
+// updated.
+static int damage_window(GUI_context *ctx)
+{
+  SDL_Surface *ws = SDL_GetWindowSurface(ctx->window);
+  SDL_Surface *src = ctx->shadow ? ctx->shadow : ws;
+  int tw = (src->w + GUI_TILE - 1) / GUI_TILE;
+  int th = (src->h + GUI_TILE - 1) / GUI_TILE;
+  bool full = false;
+  // A new size, or an expose event (which sets last_w to 0), needs a full
+  // update.
+  if (src->w != ctx->last_w || src->h != ctx->last_h) {
+    free(ctx->last);
+    free(ctx->damage);
+    ctx->last = malloc((size_t)src->w * src->h * sizeof(uint32_t));
+    ctx->damage = malloc((size_t)tw * th * sizeof(SDL_Rect));
+    ctx->last_w = src->w;
+    ctx->last_h = src->h;
+    full = true;
+  }
+  int n = 0;
+  if (!ctx->last || !ctx->damage) {
+    ctx->last_w = ctx->last_h = 0;
+    full = true;
+  } else if (full) {
+    // Nothing to compare with; this frame becomes the last one.
+    const unsigned char *data = src->pixels;
+    for (int y = 0; y < src->h; y++) {
+      memcpy(ctx->last + (size_t)y * src->w, data + (size_t)y * src->pitch,
+             (size_t)src->w * sizeof(uint32_t));
+    }
+  }
+  if (full) {
+    if (ctx->shadow) {
+      SDL_BlitSurface(ctx->shadow, 0, ws, 0);
+    }
+    if (SDL_MUSTLOCK(ws)) {
+      SDL_UnlockSurface(ws);
+    }
+    return -1;
+  }
+  for (int ty = 0; ty < th; ty++) {
+    int y0 = ty * GUI_TILE;
+    int y1 = y0 + GUI_TILE < src->h ? y0 + GUI_TILE : src->h;
+    bool open = false;
+    for (int tx = 0; tx < tw; tx++) {
+      int x0 = tx * GUI_TILE;
+      int x1 = x0 + GUI_TILE < src->w ? x0 + GUI_TILE : src->w;
+      if (tile_changed(src, ctx->last, x0, y0, x1, y1)) {
+        // Merge with the previous tile in this row if that changed too.
+        if (open) {
+          ctx->damage[n - 1].w = x1 - ctx->damage[n - 1].x;
+        } else {
+          ctx->damage[n++] = (SDL_Rect) {
+            x0, y0, x1 - x0, y1 - y0
+          };
+          open = true;
+        }
+      } else {
+        open = false;
+      }
+    }
+  }
+  if (ctx->shadow) {
+    for (int k = 0; k < n; k++) {
+      SDL_Rect r = ctx->damage[k];
+      SDL_BlitSurface(ctx->shadow, &ctx->damage[k], ws, &r);
+    }
+  }
+  if (SDL_MUSTLOCK(ws)) {
+    SDL_UnlockSurface(ws);
+  }
+  return n;
+}
+
+// Add a duration to the histogram of a latency stage.
+static void latency_add(GUI_latency *lat, int stage, uint64_t ns)
+{
+  uint64_t us = ns / 1000;
+  int bucket = 0;
+  while (us > 1 && bucket < GUI_LAT_BUCKETS - 1) {
+    us >>= 1;
+    bucket++;
+  }
+  lat->hist[stage][bucket]++;
+  lat->sum_ns[stage] += ns;
+  if (ns > lat->max_ns[stage]) {
+    lat->max_ns[stage] = ns;
+  }
+  lat->last_ns[stage] = ns;
+  lat->samples[stage]++;
+}
+
+// Record the latency of the input consumed by this frame, if any.
+static void latency_record(GUI_context *ctx, uint64_t widgets, uint64_t raster,
+                           uint64_t present)
+{
+  if (ctx->nevents == 0) {
+    return;
+  }
+  GUI_latency *lat = &ctx->latency;
+  // Every event is shown by this frame.
+  for (int32_t k = 0; k < ctx->nevents; k++) {
+    // Timestamps come from the same clock, but guard against an event that
+    // is stamped after the frame started.
+    uint64_t input = ctx->events[k].timestamp;
+    if (input > ctx->lat_begin) {
+      input = ctx->lat_begin;
+    }
+    latency_add(lat, GUI_LAT_QUEUE, ctx->lat_begin - input);
+    latency_add(lat, GUI_LAT_TOTAL, present - input);
+  }
+  latency_add(lat, GUI_LAT_WIDGETS, widgets - ctx->lat_begin);
+  latency_add(lat, GUI_LAT_RASTER, raster - widgets);
+  latency_add(lat, GUI_LAT_PRESENT, present - raster);
+  lat->count++;
+  lat->last_frame = ctx->frame;
+}
+
+void gui_latency_reset(GUI_context *c)
+{
+  assert(c);
+  c->latency = (GUI_latency) {
+    0
+  };
+}
+
+void gui_latency_dump(const GUI_context *c, FILE *f)
+{
+  assert(c);
+  assert(f);
+  static const char *names[GUI_LAT_STAGES] = {
+    "queue", "widgets", "raster", "present", "total"
+  };
+  const GUI_latency *lat = &c->latency;
+  fprintf(f, "# input-to-photon latency, %llu events in %llu frames\n",
+          (unsigned long long)lat->samples[GUI_LAT_TOTAL],
+          (unsigned long long)lat->count);
+  fprintf(f, "# stage mean_us p50_us p99_us max_us, then the counts of "
+          "buckets [2^k, 2^(k+1)) us\n");
+  for (int st = 0; st < GUI_LAT_STAGES; st++) {
+    // Percentiles are given as the upper bound of their bucket.
+    uint64_t p50 = 0, p99 = 0, seen = 0, n = lat->samples[st];
+    for (int k = 0; k < GUI_LAT_BUCKETS; k++) {
+      seen += lat->hist[st][k];
+      if (!p50 && 2 * seen >= n && n) {
+        p50 = 2ULL << k;
+      }
+      if (!p99 && 100 * seen >= 99 * n && n) {
+        p99 = 2ULL << k;
+      }
+    }
+    fprintf(f, "%s %.1f %llu %llu %.1f", names[st],
+            n ? lat->sum_ns[st] / 1000.0 / n : 0.0,
+            (unsigned long long)p50, (unsigned long long)p99,
+            lat->max_ns[st] / 1000.0);
+    for (int k = 0; k < GUI_LAT_BUCKETS; k++) {
+      fprintf(f, " %u", lat->hist[st][k]);
+    }
+    fputc('\n', f);
+  }
 }
 
 void gui_end(GUI_context *ctx)
 {
   assert(ctx);
+  uint64_t t_widgets = SDL_GetTicksNS();
+  if (ctx->popup_hit) {
+    // The next frame starts from the real state of the mouse.
+    ctx->mouse_x = ctx->popup_mouse_x;
+    ctx->mouse_y = ctx->popup_mouse_y;
+    ctx->button_pressed = ctx->popup_pressed;
+    ctx->popup_hit = false;
+  }
   ctx->button_released = false;
   ctx->keycode = 0;
   ctx->mod = 0;
+  ctx->wheel = 0.0f;
+  if (ctx->capture) {
+    capture_frame(ctx);
+  }
   // Clean up
   cairo_destroy(ctx->ctx);
   cairo_surface_destroy(ctx->surface);
   ctx->surface = 0;
-  SDL_UnlockTexture(ctx->texture);
-  SDL_RenderTexture(ctx->renderer, ctx->texture, 0, 0);
-  SDL_RenderPresent(ctx->renderer);
+  int ndamage = 0;
+  if (ctx->window) {
+    ndamage = damage_window(ctx);
+  } else {
+    SDL_UnlockTexture(ctx->texture);
+    SDL_RenderTexture(ctx->renderer, ctx->texture, 0, 0);
+  }
+  uint64_t t_raster = SDL_GetTicksNS();
+  // Waiting for vsync is not part of the cost of a frame.
+  ctx->frame_ms = (double)(SDL_GetPerformanceCounter() - ctx->frame_start) *
+                  1000.0 / SDL_GetPerformanceFrequency();
+  govern_quality(ctx);
+  if (!ctx->window) {
+    SDL_RenderPresent(ctx->renderer);
+  } else if (ndamage < 0) {
+    SDL_UpdateWindowSurface(ctx->window);
+  } else if (ndamage > 0) {
+    SDL_UpdateWindowSurfaceRects(ctx->window, ctx->damage, ndamage);
+  }
+  latency_record(ctx, t_widgets, t_raster, SDL_GetTicksNS());
+  ctx->nevents = 0;
   ctx->maxid = ctx->counter;
+  state_collect(ctx);
+}
+
+void gui_free(GUI_context *ctx)
+{
+  assert(ctx);
+  free(ctx->mcache);
+  ctx->mcache = 0;
+  ctx->nslots = 0;
+  free(ctx->last);
+  free(ctx->damage);
+  ctx->last = 0;
+  ctx->damage = 0;
+  ctx->last_w = ctx->last_h = 0;
+  if (ctx->shadow) {
+    SDL_DestroySurface(ctx->shadow);
+    ctx->shadow = 0;
+  }
+  gui_capture_stop(ctx);
+  gui_atlas_free(ctx);
+  for (int32_t k = 0; k < ctx->state_cap; k++) {
+    free(ctx->state_data[k]);
+  }
+  free(ctx->state_keys);
+  free(ctx->state_used);
+  free(ctx->state_data);
+  ctx->state_keys = 0;
+  ctx->state_used = 0;
+  ctx->state_data = 0;
+  ctx->state_cap = ctx->state_count = 0;
+  for (int k = 0; k < GUI_MAX_GROUPS; k++) {
+    if (ctx->groups[k].surface) {
+      cairo_surface_destroy(ctx->groups[k].surface);
+    }
+    ctx->groups[k] = (GUI_group) {
+      0
+    };
+  }
 }
 
 void gui_theme_light(GUI_context *ctx)
@@ -88,12 +1436,73 @@ void gui_theme_dark(GUI_context *ctx)
   }; // Blue #268bd2
 }
 
+// Add an event to the input for the next frame. Consecutive motion or wheel
+// events are merged, adding up their deltas.
+static void input_push(GUI_context *ctx, const GUI_input *in)
+{
+  if (ctx->npending > 0) {
+    GUI_input *last = &ctx->pending[ctx->npending - 1];
+    if (last->type == in->type &&
+        (in->type == GUI_INPUT_MOTION || in->type == GUI_INPUT_WHEEL)) {
+      last->x = in->x;
+      last->y = in->y;
+      last->dx += in->dx;
+      last->dy += in->dy;
+      return;
+    }
+  }
+  if (ctx->npending == GUI_MAX_INPUT) {
+    ctx->input_dropped++;
+    return;
+  }
+  ctx->pending[ctx->npending++] = *in;
+}
+
+// Iterate over the keys of this frame, except Tab:
+// for (int32_t pos = 0; next_key(c, &pos, &key, &mod);) { ... }
+static bool next_key(const GUI_context *c, int32_t *pos, int32_t *key,
+                     int16_t *mod)
+{
+  while (*pos < c->nevents) {
+    const GUI_input *in = &c->events[(*pos)++];
+    if (in->type == GUI_INPUT_KEY && in->key != SDLK_TAB) {
+      *key = in->key;
+      *mod = in->mod;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns true if the key was pressed in this frame.
+static bool key_pressed(const GUI_context *c, int32_t key)
+{
+  int32_t k, pos = 0;
+  int16_t mod;
+  while (next_key(c, &pos, &k, &mod)) {
+    if (k == key) {
+      return true;
+    }
+  }
+  return false;
+}
+
 SDL_AppResult gui_process_events(GUI_context *ctx, SDL_Event *event)
 {
   int w, h;
+  GUI_input in = {.timestamp = event->common.timestamp};
   switch (event->type) {
+    case SDL_EVENT_WINDOW_EXPOSED:
+      // The window surface has to be presented completely again.
+      ctx->last_w = ctx->last_h = 0;
+      break;
     case SDL_EVENT_WINDOW_RESIZED:
-      // Resize the texture if the window size changes.
+      // Resize the texture if the window size changes. The window surface
+      // is resized by SDL, and has to be presented completely.
+      ctx->last_w = ctx->last_h = 0;
+      if (!ctx->renderer) {
+        break;
+      }
       SDL_DestroyTexture(ctx->texture);
       SDL_GetWindowSize(SDL_GetRenderWindow(ctx->renderer), &w, &h);
       ctx->texture = SDL_CreateTexture(ctx->renderer, SDL_PIXELFORMAT_ARGB8888,
@@ -105,98 +1514,374 @@ SDL_AppResult gui_process_events(GUI_context *ctx, SDL_Event *event)
     case SDL_EVENT_KEY_UP:
       if (event->key.key == 'q' || event->key.key == SDLK_ESCAPE) {
         return SDL_APP_SUCCESS;
-      } else if (event->key.key == SDLK_TAB) {
-        if (event->key.mod & (SDL_KMOD_LSHIFT|SDL_KMOD_RSHIFT)) {
-          ctx->id--;
-          if (ctx->id < 0) {
-            ctx->id = ctx->maxid;
-          }
-        } else {
-          ctx->id++;
-          if (ctx->id > ctx->maxid) {
-            ctx->id = 1;
-          }
-        }
-      } else {
-        ctx->keycode = event->key.key;
-        ctx->mod = event->key.mod;
       }
+      in.type = GUI_INPUT_KEY;
+      in.key = event->key.key;
+      in.mod = event->key.mod;
+      input_push(ctx, &in);
       break;
     case SDL_EVENT_MOUSE_MOTION:
-      ctx->mouse_x = event->motion.x;
-      ctx->mouse_y = event->motion.y;
+      in.type = GUI_INPUT_MOTION;
+      in.x = event->motion.x;
+      in.y = event->motion.y;
+      in.dx = event->motion.xrel;
+      in.dy = event->motion.yrel;
+      input_push(ctx, &in);
       break;
     case SDL_EVENT_MOUSE_BUTTON_DOWN:
-      ctx->button_pressed = true;
-      ctx->button_released = false;
-      break;
     case SDL_EVENT_MOUSE_BUTTON_UP:
-      ctx->button_pressed = false;
-      ctx->button_released = true;
+      in.type = event->type == SDL_EVENT_MOUSE_BUTTON_DOWN ?
+                GUI_INPUT_BUTTON_DOWN : GUI_INPUT_BUTTON_UP;
+      in.button = event->button.button;
+      in.x = event->button.x;
+      in.y = event->button.y;
+      input_push(ctx, &in);
+      break;
+    case SDL_EVENT_MOUSE_WHEEL:
+      in.type = GUI_INPUT_WHEEL;
+      in.dy = event->wheel.y;
+      input_push(ctx, &in);
       break;
     default:
-      if (ctx->button_released) {
-        ctx->button_released = false;
-      }
       break;
   }
   return SDL_APP_CONTINUE;
 }
 
 
-bool gui_button(GUI_context *c, double x, double y, const char *label)
+// Icon atlas. Shelves are rows of icons; an icon goes on the open shelf
+// that wastes the least height, or on a new shelf below the others.
+typedef struct GUI_shelf {
+  int32_t y, h;     // Position and height of the shelf.
+  int32_t x;        // Start of the free space.
+} GUI_shelf;
+
+// Space between icons, so that scaled drawing does not pick up neighbours.
+#define ATLAS_PAD 1
+
+static bool atlas_place(GUI_atlas *a, int32_t size, int32_t w, int32_t h,
+                        int32_t *x, int32_t *y)
+{
+  w += ATLAS_PAD;
+  h += ATLAS_PAD;
+  int32_t best = -1;
+  for (int32_t k = 0; k < a->nshelves; k++) {
+    const GUI_shelf *sh = &a->shelves[k];
+    if (sh->h >= h && size - sh->x >= w &&
+        (best < 0 || sh->h < a->shelves[best].h)) {
+      best = k;
+    }
+  }
+  // Don't put small icons on a much higher shelf if a new one fits.
+  int32_t bottom = 0;
+  if (a->nshelves > 0) {
+    const GUI_shelf *last = &a->shelves[a->nshelves - 1];
+    bottom = last->y + last->h;
+  }
+  if (best >= 0 && (a->shelves[best].h <= 2 * h || size - bottom < h)) {
+    GUI_shelf *sh = &a->shelves[best];
+    *x = sh->x;
+    *y = sh->y;
+    sh->x += w;
+    return true;
+  }
+  if (size - bottom < h || w > size) {
+    return false;
+  }
+  if (a->nshelves == a->shelf_cap) {
+    int32_t cap = a->shelf_cap ? 2 * a->shelf_cap : 16;
+    GUI_shelf *shelves = realloc(a->shelves, cap * sizeof(GUI_shelf));
+    if (!shelves) {
+      return false;
+    }
+    a->shelves = shelves;
+    a->shelf_cap = cap;
+  }
+  a->shelves[a->nshelves++] = (GUI_shelf) {
+    bottom, h, w
+  };
+  *x = 0;
+  *y = bottom;
+  return true;
+}
+
+// Size and number of an icon, for sorting.
+typedef struct {
+  int32_t h, w;
+  int32_t index;
+} GUI_icon_order;
+
+static int cmp_icon_height(const void *a, const void *b)
+{
+  const GUI_icon_order *ia = a, *ib = b;
+  if (ia->h != ib->h) {
+    return ib->h - ia->h;
+  }
+  return ib->w - ia->w;
+}
+
+// Make room for an icon of w×h pixels, packing all icons again, tallest
+// first, into a surface that is as large as needed (up to the maximum size).
+// The pixels of the icons are copied from the old surface. The position for
+// the new icon is returned in x, y.
+static bool atlas_repack(GUI_atlas *a, int32_t w, int32_t h, int32_t *x,
+                         int32_t *y)
+{
+  int32_t max = a->max > 0 ? a->max : 2048;
+  GUI_icon_order *order = malloc((a->nicons + 1) * sizeof(GUI_icon_order));
+  GUI_icon *placed = malloc((a->nicons + 1) * sizeof(GUI_icon));
+  if (!order || !placed) {
+    free(order);
+    free(placed);
+    return false;
+  }
+  for (int32_t k = 0; k < a->nicons; k++) {
+    order[k] = (GUI_icon_order) {
+      a->icons[k].h, a->icons[k].w, k
+    };
+  }
+  qsort(order, a->nicons, sizeof(GUI_icon_order), cmp_icon_height);
+  // Pack into new shelves, so the atlas is unchanged if this fails. The new
+  // icon goes last. Start with the current size, since sorting alone often
+  // makes enough room.
+  GUI_atlas next = {0};
+  int32_t size = a->size > 0 ? a->size : 256;
+  bool ok = false;
+  while (!ok && size <= max) {
+    next.nshelves = 0;
+    ok = true;
+    for (int32_t k = 0; ok && k < a->nicons; k++) {
+      GUI_icon *icon = &placed[order[k].index];
+      *icon = a->icons[order[k].index];
+      ok = atlas_place(&next, size, icon->w, icon->h, &icon->x, &icon->y);
+    }
+    ok = ok && atlas_place(&next, size, w, h, x, y);
+    if (!ok) {
+      size *= 2;
+    }
+  }
+  free(order);
+  cairo_surface_t *surface = 0;
+  if (ok) {
+    surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, size, size);
+    ok = cairo_surface_status(surface) == CAIRO_STATUS_SUCCESS;
+  }
+  if (!ok) {
+    if (surface) {
+      cairo_surface_destroy(surface);
+    }
+    free(placed);
+    free(next.shelves);
+    return false;
+  }
+  if (a->surface) {
+    cairo_t *cr = cairo_create(surface);
+    cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+    for (int32_t k = 0; k < a->nicons; k++) {
+      const GUI_icon *from = &a->icons[k], *to = &placed[k];
+      cairo_set_source_surface(cr, a->surface, to->x - from->x,
+                               to->y - from->y);
+      cairo_rectangle(cr, to->x, to->y, to->w, to->h);
+      cairo_fill(cr);
+    }
+    cairo_destroy(cr);
+    cairo_surface_destroy(a->surface);
+  }
+  memcpy(a->icons, placed, a->nicons * sizeof(GUI_icon));
+  free(placed);
+  free(a->shelves);
+  a->shelves = next.shelves;
+  a->nshelves = next.nshelves;
+  a->shelf_cap = next.shelf_cap;
+  a->surface = surface;
+  a->size = size;
+  a->repacks++;
+  return true;
+}
+
+int32_t gui_icon_add(GUI_context *c, cairo_surface_t *src, int32_t w,
+                     int32_t h)
+{
+  assert(c);
+  assert(src);
+  GUI_atlas *a = &c->atlas;
+  if (w <= 0 || h <= 0 ||
+      cairo_surface_status(src) != CAIRO_STATUS_SUCCESS) {
+    return -1;
+  }
+  if (a->nicons == a->cap) {
+    int32_t cap = a->cap ? 2 * a->cap : 64;
+    GUI_icon *icons = realloc(a->icons, cap * sizeof(GUI_icon));
+    if (!icons) {
+      return -1;
+    }
+    a->icons = icons;
+    a->cap = cap;
+  }
+  int32_t x, y;
+  if ((!a->surface || !atlas_place(a, a->size, w, h, &x, &y)) &&
+      !atlas_repack(a, w, h, &x, &y)) {
+    return -1;
+  }
+  // Draw the source once, scaled to the size of the icon.
+  cairo_t *cr = cairo_create(a->surface);
+  cairo_rectangle(cr, x, y, w, h);
+  cairo_clip(cr);
+  cairo_translate(cr, x, y);
+  // Other surfaces have no size of their own; they are drawn as they are.
+  if (cairo_surface_get_type(src) == CAIRO_SURFACE_TYPE_IMAGE) {
+    double sw = cairo_image_surface_get_width(src);
+    double sh = cairo_image_surface_get_height(src);
+    if (sw > 0 && sh > 0) {
+      cairo_scale(cr, w / sw, h / sh);
+    }
+  }
+  cairo_set_source_surface(cr, src, 0, 0);
+  cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_GOOD);
+  cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+  cairo_paint(cr);
+  cairo_destroy(cr);
+  cairo_surface_mark_dirty(a->surface);
+  a->icons[a->nicons] = (GUI_icon) {
+    x, y, w, h
+  };
+  return a->nicons++;
+}
+
+int32_t gui_icon_add_png(GUI_context *c, const char *path, int32_t w,
+                         int32_t h)
+{
+  assert(c);
+  assert(path);
+  cairo_surface_t *src = cairo_image_surface_create_from_png(path);
+  int32_t icon = gui_icon_add(c, src, w, h);
+  cairo_surface_destroy(src);
+  return icon;
+}
+
+void gui_icon(GUI_context *c, int32_t icon, double x, double y)
+{
+  assert(c);
+  if (icon < 0 || icon >= c->atlas.nicons) {
+    return;
+  }
+  const GUI_icon *r = &c->atlas.icons[icon];
+  if (gui_culled(c, x, y, r->w, r->h)) {
+    return;
+  }
+  cairo_new_path(c->ctx);
+  cairo_set_source_surface(c->ctx, c->atlas.surface, x - r->x, y - r->y);
+  cairo_rectangle(c->ctx, x, y, r->w, r->h);
+  cairo_fill(c->ctx);
+}
+
+void gui_atlas_free(GUI_context *c)
+{
+  assert(c);
+  GUI_atlas *a = &c->atlas;
+  if (a->surface) {
+    cairo_surface_destroy(a->surface);
+  }
+  free(a->icons);
+  free(a->shelves);
+  *a = (GUI_atlas) {
+    .max = a->max
+  };
+}
+
+// Buttons with an optional icon (-1 for none) left of an optional label.
+static bool button(GUI_context *c, double x, double y, int32_t icon,
+                   const char *label)
 {
   assert(c);
   // All interactive widgets should get an ID by increasing the counter.
   int32_t id = c->counter++;
   double rv = false;
   double offset = 10.0;
+  const GUI_icon *ic = 0;
+  if (icon >= 0 && icon < c->atlas.nicons) {
+    ic = &c->atlas.icons[icon];
+  }
+  if (!label) {
+    label = "";
+  }
+  GUI_measure *m = gui_slot(c);
+  double inner = ic ? fmax(f_height, ic->h) : f_height;
+  if (gui_culled(c, x, y, -1.0, 2*offset + inner)) {
+    gui_skipped(c, m, x, y, -1.0, 2*offset + inner);
+    return false;
+  }
   cairo_text_extents_t ext;
-  cairo_text_extents(c->ctx, label, &ext);
+  gui_extents(c, m, label, &ext);
+  double text_x = x + offset;
   double width = 2*offset + ext.width;
-  double height = 2*offset +ext.height;
+  double height = 2*offset + ext.height;
+  if (ic) {
+    double gap = *label ? offset / 2 : 0.0;
+    text_x += ic->w + gap;
+    width += ic->w + gap;
+    height = fmax(height, 2*offset + ic->h);
+  }
   // Draw button outline.
-  cairo_new_path(c->ctx);
-  cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
-  cairo_rectangle(c->ctx, x, y, width, height);
-  cairo_stroke(c->ctx);
+  gui_rect_stroke(c, &c->fg, x, y, width, height);
   // draw/Fill inside if mouse is inside, or we have the highlight.
   if ((c->mouse_x >= x && (c->mouse_x - x) <= width &&
       c->mouse_y >= y && (c->mouse_y - y) <= height)|| c->id == id) {
     c->id = id;
-    cairo_new_path(c->ctx);
-    cairo_set_source_rgb(c->ctx, c->acc.r, c->acc.g, c->acc.b);
-    cairo_rectangle(c->ctx, x+1, y+1, width-2, height-2);
     if (c->button_pressed) {
-      cairo_fill(c->ctx);
+      gui_rect_fill(c, &c->acc, x+1, y+1, width-2, height-2);
     } else {
-      cairo_stroke(c->ctx);
+      gui_accent(c, x+1, y+1, width-2, height-2);
     }
-    if (c->button_released || c->keycode == SDLK_RETURN) {
+    if (c->button_released || key_pressed(c, SDLK_RETURN)) {
       rv = true;
     }
   }
+  // Draw the icon, one blit from the atlas.
+  if (ic) {
+    gui_icon(c, icon, x + offset, y + round((height - ic->h) / 2));
+  }
   // Draw the label
-  cairo_new_path(c->ctx);
-  cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
-  cairo_move_to(c->ctx, x + offset, y+offset+ext.height);
-  cairo_show_text(c->ctx, label);
-  cairo_fill(c->ctx);
+  if (*label) {
+    cairo_new_path(c->ctx);
+    cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
+    cairo_move_to(c->ctx, text_x, y + (height - ext.height)/2 + ext.height);
+    cairo_show_text(c->ctx, label);
+    cairo_fill(c->ctx);
+  }
+  gui_placed(c, m, x, y, width, height);
   return rv;
 }
 
+bool gui_button(GUI_context *c, double x, double y, const char *label)
+{
+  return button(c, x, y, -1, label);
+}
+
+bool gui_iconbutton(GUI_context *c, double x, double y, int32_t icon,
+                    const char *label)
+{
+  return button(c, x, y, icon, label);
+}
+
 void gui_label(GUI_context *c, double x, double y, const char *label)
 {
   assert(c);
   // Labels don't interact, so they have no id.
+  GUI_measure *m = gui_slot(c);
+  if (gui_culled(c, x, y, -1.0, f_height)) {
+    gui_skipped(c, m, x, y, -1.0, f_height);
+    return;
+  }
   cairo_text_extents_t ext;
-  cairo_text_extents(c->ctx, label, &ext);
+  gui_extents(c, m, label, &ext);
   // Draw the label
   cairo_new_path(c->ctx);
   cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
   cairo_move_to(c->ctx, x, y+ext.height);
   cairo_show_text(c->ctx, label);
   cairo_fill(c->ctx);
+  gui_placed(c, m, x, y, ext.x_advance, ext.height);
 }
 
 bool gui_checkbox(GUI_context *c, double x, double y, const char *label, bool *state)
@@ -206,31 +1891,38 @@ bool gui_checkbox(GUI_context *c, double x, double y, const char *label, bool *s
   double rv = false;
   double offset = 5.0;
   double boxsize = m_width>m_height?m_width:m_height;
+  GUI_measure *m = gui_slot(c);
+  if (gui_culled(c, x, y, -1.0, boxsize)) {
+    gui_skipped(c, m, x, y, -1.0, boxsize);
+    return false;
+  }
   cairo_text_extents_t ext;
-  cairo_text_extents(c->ctx, label, &ext);
+  gui_extents(c, m, label, &ext);
   double width = 2*offset + ext.width + boxsize;
   double height = 2*offset + ext.height>boxsize?ext.height:boxsize;
   // Draw checkbox outline.
-  cairo_new_path(c->ctx);
-  cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
-  cairo_rectangle(c->ctx, x, y, boxsize, boxsize);
-  cairo_stroke(c->ctx);
+  gui_rect_stroke(c, &c->fg, x, y, boxsize, boxsize);
   // draw/Fill inside if mouse is inside, or we have the highlight.
   if ((c->mouse_x >= x && (c->mouse_x - x) <= width &&
       c->mouse_y >= y && (c->mouse_y - y) <= height)|| c->id == id) {
     c->id = id;
-    cairo_new_path(c->ctx);
-    cairo_set_source_rgb(c->ctx, c->acc.r, c->acc.g, c->acc.b);
-    cairo_rectangle(c->ctx, x+1, y+1, boxsize-2, boxsize-2);
     if (c->button_pressed) {
-      cairo_fill(c->ctx);
+      gui_rect_fill(c, &c->acc, x+1, y+1, boxsize-2, boxsize-2);
     } else {
-      cairo_stroke(c->ctx);
+      gui_accent(c, x+1, y+1, boxsize-2, boxsize-2);
     }
-    if (c->button_released || c->keycode == SDLK_RETURN) {
+    if (c->button_released) {
       rv = true;
       *state = !*state;
     }
+    int32_t key, pos = 0;
+    int16_t mod;
+    while (next_key(c, &pos, &key, &mod)) {
+      if (key == SDLK_RETURN) {
+        rv = true;
+        *state = !*state;
+      }
+    }
   }
   // Draw selected mark if needed.
   if (*state) {
@@ -248,6 +1940,8 @@ bool gui_checkbox(GUI_context *c, double x, double y, const char *label, bool *s
   cairo_move_to(c->ctx, x + boxsize + offset, y+boxsize/2+ext.height/2);
   cairo_show_text(c->ctx, label);
   cairo_fill(c->ctx);
+  gui_placed(c, m, x, y, boxsize + offset + ext.x_advance,
+             ext.height>boxsize?ext.height:boxsize);
   return rv;
 }
 
@@ -262,17 +1956,27 @@ bool gui_radiobuttons(GUI_context *c, double x, double y, int nlabels,
   double offset = 5.0;
   //double boxsize = 14.0;
   double boxsize = (m_width>m_height?m_width:m_height)*1.5;
+  // Every label has its own measurement slot; the first one also holds the
+  // size of the whole widget.
+  GUI_measure *m = gui_slot(c);
+  if (gui_culled(c, x, y, -1.0,
+                 nlabels*(boxsize>f_height?boxsize:f_height) + 2*offset)) {
+    c->slot += nlabels - 1;
+    gui_skipped(c, m, x, y, -1.0,
+                nlabels*(boxsize>f_height?boxsize:f_height) + 2*offset);
+    return false;
+  }
   double width, height;
   double heights[nlabels];
   double exty[nlabels];
   cairo_text_extents_t ext = {0};
-  cairo_text_extents(c->ctx, labels[0], &ext);
+  gui_extents(c, m, labels[0], &ext);
   width = ext.width;
   height = ext.height;
   heights[0] = ext.height>boxsize?ext.height:boxsize;
   exty[0] = ext.height;
   for (int k = 1; k < nlabels; k++) {
-    cairo_text_extents(c->ctx, labels[k], &ext);
+    gui_extents(c, gui_slot(c), labels[k], &ext);
     heights[k] = ext.height>boxsize?ext.height:boxsize;
     exty[k] = ext.height;
     if (width < ext.width) {
@@ -324,21 +2028,29 @@ bool gui_radiobuttons(GUI_context *c, double x, double y, int nlabels,
         cairo_arc(c->ctx, curx, cury, boxsize/2 - 3, 0.0, 2*M_PI);
         if (c->button_pressed) {
           cairo_fill(c->ctx);
-        } else {
+        } else if (c->quality < GUI_QUALITY_NO_ACCENTS) {
           cairo_stroke(c->ctx);
         }
-        if (c->button_released || c->keycode == SDLK_RETURN) {
+        if (c->button_released) {
           rv = true;
           *state = k;
-        } else if (c->keycode == SDLK_UP) {
-          *state = --k;
-          if (*state < 0) {
-            *state = nlabels-1;
-          }
-        } else if (c->keycode == SDLK_DOWN) {
-          *state = ++k;
-          if (*state == nlabels) {
-            *state = 0;
+        }
+        int32_t key, pos = 0;
+        int16_t mod;
+        while (next_key(c, &pos, &key, &mod)) {
+          if (key == SDLK_RETURN) {
+            rv = true;
+            *state = k;
+          } else if (key == SDLK_UP) {
+            *state = --k;
+            if (*state < 0) {
+              *state = k = nlabels-1;
+            }
+          } else if (key == SDLK_DOWN) {
+            *state = ++k;
+            if (*state == nlabels) {
+              *state = k = 0;
+            }
           }
         }
         break;
@@ -346,6 +2058,7 @@ bool gui_radiobuttons(GUI_context *c, double x, double y, int nlabels,
       cury += heights[k];
     }
   }
+  gui_placed(c, m, x, y, width, height);
   return rv;
 }
 
@@ -354,10 +2067,13 @@ void gui_colorsample(GUI_context *c, const double x, const double y,
 {
   assert(c);
   assert(state);
-  cairo_new_path(c->ctx);
-  cairo_set_source_rgb(c->ctx, state->r, state->g, state->b);
-  cairo_rectangle(c->ctx, x, y, w, h);
-  cairo_fill(c->ctx);
+  GUI_measure *m = gui_slot(c);
+  if (gui_culled(c, x, y, w, h)) {
+    gui_placed(c, m, x, y, w, h);
+    return;
+  }
+  gui_rect_fill(c, state, x, y, w, h);
+  gui_placed(c, m, x, y, w, h);
 }
 
 bool gui_slider(GUI_context *c, const double x, const double y, int *state)
@@ -371,34 +2087,37 @@ bool gui_slider(GUI_context *c, const double x, const double y, int *state)
   const double offset = 4.0;
   const double width = 255.0 + xsize + 2*offset;
   const double height = ysize + 2*offset;
+  GUI_measure *m = gui_slot(c);
+  if (gui_culled(c, x, y, width, height)) {
+    gui_placed(c, m, x, y, width, height);
+    return false;
+  }
   // Draw outside rectangle
-  cairo_new_path(c->ctx);
-  cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
-  cairo_rectangle(c->ctx, x, y, width, height);
-  cairo_stroke(c->ctx);
+  gui_rect_stroke(c, &c->fg, x, y, width, height);
   // draw/Fill inside if mouse is inside, or we have the highlight.
   if ((c->mouse_x >= x && (c->mouse_x - x) <= width &&
       c->mouse_y >= y && (c->mouse_y - y) <= height)|| c->id == id) {
     c->id = id;
     // draw inside if mouse is inside.
-    cairo_new_path(c->ctx);
-    cairo_set_source_rgb(c->ctx, c->acc.r, c->acc.g, c->acc.b);
-    cairo_rectangle(c->ctx, x+2, y+2, width-4, height-4);
-    cairo_stroke(c->ctx);
+    gui_accent(c, x+2, y+2, width-4, height-4);
     // Update state if mouse is inside and button is pressed
-    if (c->button_pressed || c->keycode == SDLK_RETURN) {
+    if (c->button_pressed || key_pressed(c, SDLK_RETURN)) {
       int newstate = round(c->mouse_x - x - offset - xsize/2.0);
       if (newstate != *state) {
         *state = newstate;
         changed = true;
       }
     }
-    if (c->keycode == SDLK_LEFT) {
-      (*state)--;
-      changed = true;
-    } else if (c->keycode == SDLK_RIGHT) {
-      (*state)++;
-      changed = true;
+    int32_t key, pos = 0;
+    int16_t mod;
+    while (next_key(c, &pos, &key, &mod)) {
+      if (key == SDLK_LEFT) {
+        (*state)--;
+        changed = true;
+      } else if (key == SDLK_RIGHT) {
+        (*state)++;
+        changed = true;
+      }
     }
   }
   // Clamp state within allowed range.
@@ -409,10 +2128,8 @@ bool gui_slider(GUI_context *c, const double x, const double y, int *state)
   }
   // Draw slider
   double sliderpos = x + (double)*state + offset;
-  cairo_new_path(c->ctx);
-  cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
-  cairo_rectangle(c->ctx, sliderpos, y + offset, xsize, ysize);
-  cairo_fill(c->ctx);
+  gui_rect_fill(c, &c->fg, sliderpos, y + offset, xsize, ysize);
+  gui_placed(c, m, x, y, width, height);
   return changed;
 }
 
@@ -430,11 +2147,13 @@ bool gui_ispinner(GUI_context *c, const double x, const double y,
   const double boxsize = 12.0;
   double width = maxw + 2 * offset + 2*boxsize;
   double height = m_height + 2 * offset;
+  GUI_measure *m = gui_slot(c);
+  if (gui_culled(c, x, y, width, height)) {
+    gui_placed(c, m, x, y, width, height);
+    return false;
+  }
   // Draw the outline.
-  cairo_new_path(c->ctx);
-  cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
-  cairo_rectangle(c->ctx, x, y, width, height);
-  cairo_stroke(c->ctx);
+  gui_rect_stroke(c, &c->fg, x, y, width, height);
   // Draw the spinner buttons.
   cairo_new_path(c->ctx);
   cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
@@ -456,10 +2175,7 @@ bool gui_ispinner(GUI_context *c, const double x, const double y,
       c->mouse_y >= y && (c->mouse_y - y) <= height)|| c->id == id) {
     c->id = id;
     // Draw inside accent if mouse is inside.
-    cairo_new_path(c->ctx);
-    cairo_set_source_rgb(c->ctx, c->acc.r, c->acc.g, c->acc.b);
-    cairo_rectangle(c->ctx, x+2, y+2, width-4, height-4);
-    cairo_stroke(c->ctx);
+    gui_accent(c, x+2, y+2, width-4, height-4);
     if (c->button_pressed) {
       double xdist =  c->mouse_x - x - offset - maxw;
       if (xdist < boxsize) {
@@ -471,17 +2187,21 @@ bool gui_ispinner(GUI_context *c, const double x, const double y,
       }
     }
     // Update the value when up or down arrows are used.
-    switch (c->keycode) {
-      case SDLK_UP:
-        (*state)++;
-        rv = true;
-        break;
-      case SDLK_DOWN:
-        (*state)--;
-        rv = true;
-        break;
-      default:
-        break;
+    int32_t key, pos = 0;
+    int16_t mod;
+    while (next_key(c, &pos, &key, &mod)) {
+      switch (key) {
+        case SDLK_UP:
+          (*state)++;
+          rv = true;
+          break;
+        case SDLK_DOWN:
+          (*state)--;
+          rv = true;
+          break;
+        default:
+          break;
+      }
     }
   }
   // Clamp the state between min and max.
@@ -494,11 +2214,12 @@ bool gui_ispinner(GUI_context *c, const double x, const double y,
   char buf[20];
   snprintf(buf, 19, "%d", *state);
   cairo_text_extents_t ext;
-  cairo_text_extents(c->ctx, buf, &ext);
+  gui_extents(c, m, buf, &ext);
   cairo_new_path(c->ctx);
   cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
   cairo_move_to(c->ctx, x+offset, y+offset+ext.height);
   cairo_show_text(c->ctx, buf);
+  gui_placed(c, m, x, y, width, height);
   return rv;
 }
 
@@ -511,75 +2232,100 @@ bool gui_editbox(GUI_context *c, const double x, const double y, const double w,
   const double offset = 6.0;
   double height = m_height + 2 * offset;
   bool rv = false;
+  GUI_measure *ms = gui_slot(c);
+  if (gui_culled(c, x, y, w, height)) {
+    gui_placed(c, ms, x, y, w, height);
+    return false;
+  }
   // Draw the outline.
-  cairo_new_path(c->ctx);
-  cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
-  cairo_rectangle(c->ctx, x, y, w, height);
-  cairo_stroke(c->ctx);
+  gui_rect_stroke(c, &c->fg, x, y, w, height);
   if ((c->mouse_x >= x && (c->mouse_x - x) <= w &&
       c->mouse_y >= y && (c->mouse_y - y) <= height)|| c->id == id) {
     c->id = id;
     // Draw inside accent if mouse is inside.
-    cairo_new_path(c->ctx);
-    cairo_set_source_rgb(c->ctx, c->acc.r, c->acc.g, c->acc.b);
-    cairo_rectangle(c->ctx, x+2, y+2, w-4, height-4);
-    cairo_stroke(c->ctx);
+    gui_accent(c, x+2, y+2, w-4, height-4);
     // Process keys
-    if (c->keycode == SDLK_LEFT) { // move cursor left
-      if (state->cursorpos > 0) {
-        state->cursorpos--;
-      }
-    } else if (c->keycode == SDLK_RIGHT) { // move cursor right
-      if (state->cursorpos < state->used) {
-        state->cursorpos++;
-      }
-    } else if (c->keycode >= 0x20 && c->keycode <= 0x7e) { // insert regular key.
-      char keycode = (char)c->keycode;
-      if (c->mod & (SDL_KMOD_SHIFT|SDL_KMOD_CAPS)) {  // Handle capitals.
-        keycode -= 32;
-      }
-      if (state->cursorpos == state->used) {  // cursor at end
-        state->data[state->used++] = keycode;
-        state->cursorpos++;
-      } else if (state->cursorpos < state->used) {  // cursor inside text
-        for (int m = state->used; m >= state->cursorpos; m--) {
-          state->data[m+1] = state->data[m];
+    int32_t key, pos = 0;
+    int16_t mod;
+    while (next_key(c, &pos, &key, &mod)) {
+      if (key == SDLK_LEFT) { // move cursor left
+        if (state->cursorpos > 0) {
+          state->cursorpos--;
         }
-        state->data[state->cursorpos++] = keycode;
-        state->used++;
-
-      }
-    } else if (c->keycode == SDLK_END) {
-      state->cursorpos = state->used;
-    } else if (c->keycode == SDLK_HOME) {
-      state->cursorpos = 0;
-    } else if (c->keycode == SDLK_BACKSPACE) {
-      if (state->cursorpos > 0 && state->cursorpos <= state->used) {
-        for (int move = state->cursorpos-1; move < state->used; move++) {
-          state->data[move] = state->data[move+1];
+      } else if (key == SDLK_RIGHT) { // move cursor right
+        if (state->cursorpos < state->used) {
+          state->cursorpos++;
         }
-        state->data[state->used--] = 0;
-        state->cursorpos--;
-      }
-    } else if (c->keycode == SDLK_DELETE) {
-      if (state->cursorpos >= 0 && state->cursorpos <= state->used) {
-        for (int move = state->cursorpos; move < state->used; move++) {
-          state->data[move] = state->data[move+1];
+      } else if (key >= 0x20 && key <= 0x7e) { // insert regular key.
+        char keycode = (char)key;
+        if (mod & (SDL_KMOD_SHIFT|SDL_KMOD_CAPS)) {  // Handle capitals.
+          keycode -= 32;
         }
-        state->data[state->used--] = 0;
-        if (state->cursorpos > 0) {
+        if (state->used >= EBUF_SIZE - 1) {  // buffer full
+          continue;
+        }
+        if (state->cursorpos == state->used) {  // cursor at end
+          state->data[state->used++] = keycode;
+          state->cursorpos++;
+        } else if (state->cursorpos < state->used) {  // cursor inside text
+          for (int m = state->used; m >= state->cursorpos; m--) {
+            state->data[m+1] = state->data[m];
+          }
+          state->data[state->cursorpos++] = keycode;
+          state->used++;
+
+        }
+      } else if (key == SDLK_END) {
+        state->cursorpos = state->used;
+      } else if (key == SDLK_HOME) {
+        state->cursorpos = 0;
+      } else if (key == SDLK_BACKSPACE) {
+        if (state->cursorpos > 0 && state->cursorpos <= state->used) {
+          for (int move = state->cursorpos-1; move < state->used; move++) {
+            state->data[move] = state->data[move+1];
+          }
+          state->data[state->used--] = 0;
           state->cursorpos--;
         }
+      } else if (key == SDLK_DELETE) {
+        if (state->cursorpos >= 0 && state->cursorpos <= state->used) {
+          for (int move = state->cursorpos; move < state->used; move++) {
+            state->data[move] = state->data[move+1];
+          }
+          state->data[state->used--] = 0;
+          if (state->cursorpos > 0) {
+            state->cursorpos--;
+          }
+        }
       }
     }
-    // fill the cumulative offset array
+    // fill the cumulative offset array, unless the text, the cursor and
+    // the font are the same as in the last frame.
+    typedef struct {
+      uint64_t hash;
+      ptrdiff_t cursorpos;
+      uint32_t serial;
+      double off;
+    } cursor_cache;
+    cursor_cache *cc = gui_state(c, widget_key(id, 'c'), sizeof(cursor_cache), 0);
+    uint64_t hash = gui_hash(state->data);
     double cum_off = 0.0;
-    for (int j = 0; j < state->cursorpos; j++) {
-      char str[2] = {0};
-       cairo_text_extents_t ext;
-      str[0] = state->data[j];
-      cairo_text_extents(c->ctx, str, &ext);
-      cum_off += ext.x_advance;
+    if (cc && cc->hash == hash && cc->cursorpos == state->cursorpos &&
+        cc->serial == c->font_serial) {
+      cum_off = cc->off;
+    } else {
+      for (int j = 0; j < state->cursorpos; j++) {
+        char str[2] = {0};
+        cairo_text_extents_t ext;
+        str[0] = state->data[j];
+        cairo_text_extents(c->ctx, str, &ext);
+        cum_off += ext.x_advance;
+      }
+      if (cc) {
+        *cc = (cursor_cache) {
+          hash, state->cursorpos, c->font_serial, cum_off
+        };
+      }
     }
     // TODO: draw the cursor position
     cairo_new_path(c->ctx);
@@ -590,12 +2336,933 @@ bool gui_editbox(GUI_context *c, const double x, const double y, const double w,
   }
   // TODO: Draw the text, clip if longer than window.
   cairo_text_extents_t ext;
-  cairo_text_extents(c->ctx, state->data, &ext);
+  gui_extents(c, ms, state->data, &ext);
   cairo_new_path(c->ctx);
   cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
   cairo_move_to(c->ctx, x+offset, y+offset+ext.height);
   cairo_show_text(c->ctx, state->data);
+  gui_placed(c, ms, x, y, w, height);
+
+  return rv;
+}
+
+int32_t gui_canvas_add(GUI_canvas *cv, double x, double y, double w, double h)
+{
+  assert(cv);
+  if (cv->nitems == cv->capacity) {
+    int32_t newcap = cv->capacity ? 2 * cv->capacity : 64;
+    GUI_rect *items = realloc(cv->items, newcap * sizeof(GUI_rect));
+    uint32_t *mark = realloc(cv->mark, newcap * sizeof(uint32_t));
+    int32_t *visible = realloc(cv->visible, newcap * sizeof(int32_t));
+    // Keep whatever realloc succeeded, so nothing leaks.
+    if (items) {
+      cv->items = items;
+    }
+    if (mark) {
+      cv->mark = mark;
+    }
+    if (visible) {
+      cv->visible = visible;
+    }
+    if (!items || !mark || !visible) {
+      return -1;
+    }
+    cv->capacity = newcap;
+  }
+  int32_t item = cv->nitems++;
+  cv->items[item] = (GUI_rect) {
+    x, y, w, h
+  };
+  cv->mark[item] = 0;
+  cv->dirty = true;
+  return item;
+}
+
+void gui_canvas_set(GUI_canvas *cv, int32_t item, double x, double y,
+                    double w, double h)
+{
+  assert(cv);
+  assert(item >= 0 && item < cv->nitems);
+  cv->items[item] = (GUI_rect) {
+    x, y, w, h
+  };
+  cv->dirty = true;
+}
+
+void gui_canvas_free(GUI_canvas *cv)
+{
+  assert(cv);
+  free(cv->items);
+  free(cv->mark);
+  free(cv->visible);
+  free(cv->cellstart);
+  free(cv->cellitems);
+  *cv = (GUI_canvas) {
+    0
+  };
+}
+
+// Range of grid cells covered by the world rectangle (x0, y0)–(x1, y1).
+static void canvas_cells(const GUI_canvas *cv, double x0, double y0,
+                         double x1, double y1, int32_t *cx0, int32_t *cy0,
+                         int32_t *cx1, int32_t *cy1)
+{
+  double fx0 = floor((x0 - cv->gx) / cv->cell);
+  double fy0 = floor((y0 - cv->gy) / cv->cell);
+  double fx1 = floor((x1 - cv->gx) / cv->cell);
+  double fy1 = floor((y1 - cv->gy) / cv->cell);
+  *cx0 = fx0 < 0 ? 0 : fx0 >= cv->gw ? cv->gw - 1 : (int32_t)fx0;
+  *cy0 = fy0 < 0 ? 0 : fy0 >= cv->gh ? cv->gh - 1 : (int32_t)fy0;
+  *cx1 = fx1 < 0 ? 0 : fx1 >= cv->gw ? cv->gw - 1 : (int32_t)fx1;
+  *cy1 = fy1 < 0 ? 0 : fy1 >= cv->gh ? cv->gh - 1 : (int32_t)fy1;
+}
+
+// (Re)build the grid index. Every item is listed in all cells it overlaps.
+static bool canvas_index(GUI_canvas *cv)
+{
+  free(cv->cellstart);
+  free(cv->cellitems);
+  cv->cellstart = 0;
+  cv->cellitems = 0;
+  cv->gw = cv->gh = 0;
+  if (cv->nitems == 0) {
+    cv->dirty = false;
+    return true;
+  }
+  // Determine the bounds of the world and the average item size.
+  double x0 = cv->items[0].x, y0 = cv->items[0].y;
+  double x1 = x0, y1 = y0;
+  double avg = 0.0;
+  for (int32_t k = 0; k < cv->nitems; k++) {
+    const GUI_rect *r = &cv->items[k];
+    x0 = fmin(x0, r->x);
+    y0 = fmin(y0, r->y);
+    x1 = fmax(x1, r->x + r->w);
+    y1 = fmax(y1, r->y + r->h);
+    avg += fmax(r->w, r->h);
+  }
+  avg /= cv->nitems;
+  // Aim for about one item per cell, but cells should not be much smaller
+  // than the items, otherwise every item ends up in many cells.
+  double cell = sqrt((x1 - x0) * (y1 - y0) / cv->nitems);
+  cv->cell = fmax(fmax(cell, avg), 1.0);
+  cv->gx = x0;
+  cv->gy = y0;
+  cv->gw = (int32_t)((x1 - x0) / cv->cell) + 1;
+  cv->gh = (int32_t)((y1 - y0) / cv->cell) + 1;
+  size_t ncells = (size_t)cv->gw * cv->gh;
+  cv->cellstart = calloc(ncells + 1, sizeof(int32_t));
+  if (!cv->cellstart) {
+    cv->gw = cv->gh = 0;
+    return false;
+  }
+  // Count the items per cell, then convert counts into offsets.
+  int32_t cx0, cy0, cx1, cy1;
+  for (int32_t k = 0; k < cv->nitems; k++) {
+    const GUI_rect *r = &cv->items[k];
+    canvas_cells(cv, r->x, r->y, r->x + r->w, r->y + r->h, &cx0, &cy0, &cx1, &cy1);
+    for (int32_t cy = cy0; cy <= cy1; cy++) {
+      for (int32_t cx = cx0; cx <= cx1; cx++) {
+        cv->cellstart[cy * cv->gw + cx + 1]++;
+      }
+    }
+  }
+  for (size_t j = 0; j < ncells; j++) {
+    cv->cellstart[j + 1] += cv->cellstart[j];
+  }
+  cv->cellitems = malloc((cv->cellstart[ncells] + 1) * sizeof(int32_t));
+  int32_t *fill = malloc(ncells * sizeof(int32_t));
+  if (!cv->cellitems || !fill) {
+    free(fill);
+    free(cv->cellstart);
+    free(cv->cellitems);
+    cv->cellstart = 0;
+    cv->cellitems = 0;
+    cv->gw = cv->gh = 0;
+    return false;
+  }
+  memcpy(fill, cv->cellstart, ncells * sizeof(int32_t));
+  // Items are added in ascending order, so every cell is sorted.
+  for (int32_t k = 0; k < cv->nitems; k++) {
+    const GUI_rect *r = &cv->items[k];
+    canvas_cells(cv, r->x, r->y, r->x + r->w, r->y + r->h, &cx0, &cy0, &cx1, &cy1);
+    for (int32_t cy = cy0; cy <= cy1; cy++) {
+      for (int32_t cx = cx0; cx <= cx1; cx++) {
+        cv->cellitems[fill[cy * cv->gw + cx]++] = k;
+      }
+    }
+  }
+  free(fill);
+  cv->dirty = false;
+  return true;
+}
+
+static int cmp_int32(const void *a, const void *b)
+{
+  int32_t ia = *(const int32_t *)a, ib = *(const int32_t *)b;
+  return (ia > ib) - (ia < ib);
+}
+
+// Collect the items that overlap the world rectangle (x0, y0)–(x1, y1).
+static void canvas_query(GUI_canvas *cv, double x0, double y0, double x1,
+                         double y1)
+{
+  cv->nvisible = 0;
+  if (cv->gw == 0) {
+    return;
+  }
+  if (++cv->stamp == 0) {
+    memset(cv->mark, 0, cv->nitems * sizeof(uint32_t));
+    cv->stamp = 1;
+  }
+  int32_t cx0, cy0, cx1, cy1;
+  canvas_cells(cv, x0, y0, x1, y1, &cx0, &cy0, &cx1, &cy1);
+  for (int32_t cy = cy0; cy <= cy1; cy++) {
+    for (int32_t cx = cx0; cx <= cx1; cx++) {
+      int32_t cell = cy * cv->gw + cx;
+      for (int32_t j = cv->cellstart[cell]; j < cv->cellstart[cell + 1]; j++) {
+        int32_t k = cv->cellitems[j];
+        if (cv->mark[k] == cv->stamp) {
+          continue;
+        }
+        cv->mark[k] = cv->stamp;
+        const GUI_rect *r = &cv->items[k];
+        if (r->x <= x1 && r->x + r->w >= x0 && r->y <= y1 && r->y + r->h >= y0) {
+          cv->visible[cv->nvisible++] = k;
+        }
+      }
+    }
+  }
+  // Items that span several cells are found out of order; restore the
+  // drawing order.
+  qsort(cv->visible, cv->nvisible, sizeof(int32_t), cmp_int32);
+}
+
+// Return the topmost item that contains the world point (wx, wy), or -1.
+static int32_t canvas_hit(const GUI_canvas *cv, double wx, double wy)
+{
+  if (cv->gw == 0 || wx < cv->gx || wy < cv->gy) {
+    return -1;
+  }
+  int32_t cx = (int32_t)((wx - cv->gx) / cv->cell);
+  int32_t cy = (int32_t)((wy - cv->gy) / cv->cell);
+  if (cx >= cv->gw || cy >= cv->gh) {
+    return -1;
+  }
+  int32_t cell = cy * cv->gw + cx;
+  // Cells are sorted, so search backwards for the topmost item.
+  for (int32_t j = cv->cellstart[cell + 1] - 1; j >= cv->cellstart[cell]; j--) {
+    const GUI_rect *r = &cv->items[cv->cellitems[j]];
+    if (wx >= r->x && wx <= r->x + r->w && wy >= r->y && wy <= r->y + r->h) {
+      return cv->cellitems[j];
+    }
+  }
+  return -1;
+}
+
+int32_t gui_canvas_begin(GUI_context *c, GUI_canvas *cv, const double x,
+                         const double y, const double w, const double h)
+{
+  assert(c);
+  assert(cv);
+  int32_t id = c->counter++;
+  if (cv->zoom <= 0.0) {
+    cv->zoom = 1.0;
+  }
+  if (cv->dirty) {
+    canvas_index(cv);
+  }
+  gui_placed(c, gui_slot(c), x, y, w, h);
+  if (gui_culled(c, x, y, w, h)) {
+    // gui_canvas_end expects a saved state.
+    cv->nvisible = 0;
+    cv->hover = -1;
+    cairo_save(c->ctx);
+    return 0;
+  }
+  // Draw the outline.
+  gui_rect_stroke(c, &c->fg, x, y, w, h);
+  bool inside = c->mouse_x >= x && (c->mouse_x - x) <= w &&
+                c->mouse_y >= y && (c->mouse_y - y) <= h;
+  if (!c->button_pressed) {
+    cv->dragging = false;
+  }
+  if (inside || c->id == id) {
+    c->id = id;
+    gui_accent(c, x+2, y+2, w-4, h-4);
+    // Pan by dragging with the middle or right button.
+    if (inside && c->button_pressed &&
+        (c->button == SDL_BUTTON_MIDDLE || c->button == SDL_BUTTON_RIGHT)) {
+      if (cv->dragging) {
+        cv->pan_x -= (c->mouse_x - cv->drag_x) / cv->zoom;
+        cv->pan_y -= (c->mouse_y - cv->drag_y) / cv->zoom;
+      }
+      cv->dragging = true;
+      cv->drag_x = c->mouse_x;
+      cv->drag_y = c->mouse_y;
+    }
+    // Zoom around the cursor with the wheel.
+    if (inside && c->wheel != 0.0f) {
+      double wx = cv->pan_x + (c->mouse_x - x) / cv->zoom;
+      double wy = cv->pan_y + (c->mouse_y - y) / cv->zoom;
+      cv->zoom *= pow(1.1, c->wheel);
+      if (cv->zoom < 0.01) {
+        cv->zoom = 0.01;
+      } else if (cv->zoom > 100.0) {
+        cv->zoom = 100.0;
+      }
+      cv->pan_x = wx - (c->mouse_x - x) / cv->zoom;
+      cv->pan_y = wy - (c->mouse_y - y) / cv->zoom;
+    }
+    // Keyboard panning.
+    int32_t key, pos = 0;
+    int16_t mod;
+    while (next_key(c, &pos, &key, &mod)) {
+      switch (key) {
+        case SDLK_LEFT:
+          cv->pan_x -= 20.0 / cv->zoom;
+          break;
+        case SDLK_RIGHT:
+          cv->pan_x += 20.0 / cv->zoom;
+          break;
+        case SDLK_UP:
+          cv->pan_y -= 20.0 / cv->zoom;
+          break;
+        case SDLK_DOWN:
+          cv->pan_y += 20.0 / cv->zoom;
+          break;
+        default:
+          break;
+      }
+    }
+  }
+  // Find what is visible before any drawing is done.
+  canvas_query(cv, cv->pan_x, cv->pan_y, cv->pan_x + w / cv->zoom,
+               cv->pan_y + h / cv->zoom);
+  cv->hover = -1;
+  if (inside) {
+    cv->hover = canvas_hit(cv, cv->pan_x + (c->mouse_x - x) / cv->zoom,
+                           cv->pan_y + (c->mouse_y - y) / cv->zoom);
+  }
+  // Set up clipping and the world transform.
+  cairo_save(c->ctx);
+  cairo_new_path(c->ctx);
+  cairo_rectangle(c->ctx, x, y, w, h);
+  cairo_clip(c->ctx);
+  cairo_translate(c->ctx, x, y);
+  cairo_scale(c->ctx, cv->zoom, cv->zoom);
+  cairo_translate(c->ctx, -cv->pan_x, -cv->pan_y);
+  return cv->nvisible;
+}
+
+void gui_canvas_end(GUI_context *c, GUI_canvas *cv)
+{
+  assert(c);
+  assert(cv);
+  (void)cv;
+  cairo_restore(c->ctx);
+}
+
+static const char *combo_text(const GUI_combo *cb, int32_t index)
+{
+  const char *text = cb->option(cb->data, index);
+  return text ? text : "";
+}
+
+// Compare at most n characters (all if n < 0), ignoring case.
+static int fold_cmp(const char *a, const char *b, int32_t n)
+{
+  for (int32_t k = 0; n < 0 || k < n; k++) {
+    int ca = tolower((unsigned char)a[k]), cb = tolower((unsigned char)b[k]);
+    if (ca != cb || ca == 0) {
+      return ca - cb;
+    }
+  }
+  return 0;
+}
+
+// Text and number of an option, for sorting.
+typedef struct {
+  const char *text;
+  int32_t index;
+} GUI_option_order;
+
+static int cmp_option(const void *a, const void *b)
+{
+  const GUI_option_order *oa = a, *ob = b;
+  int rv = fold_cmp(oa->text, ob->text, -1);
+  return rv ? rv : (oa->index > ob->index) - (oa->index < ob->index);
+}
+
+static bool combo_index(GUI_combo *cb)
+{
+  size_t n = cb->noptions > 0 ? cb->noptions : 1;
+  free(cb->sorted);
+  cb->sorted = malloc(n * sizeof(int32_t));
+  GUI_option_order *order = malloc(n * sizeof(GUI_option_order));
+  cb->indexed = cb->sorted && order;
+  if (!cb->indexed) {
+    free(cb->sorted);
+    free(order);
+    cb->sorted = 0;
+    return false;
+  }
+  // The strings stay valid while the generation is the same.
+  for (int32_t k = 0; k < cb->noptions; k++) {
+    order[k] = (GUI_option_order) {
+      combo_text(cb, k), k
+    };
+  }
+  qsort(order, cb->noptions, sizeof(GUI_option_order), cmp_option);
+  for (int32_t k = 0; k < cb->noptions; k++) {
+    cb->sorted[k] = order[k].index;
+  }
+  free(order);
+  cb->indexed_gen = cb->generation;
+  return true;
+}
+
+// Find the range of sorted options that start with the filter, with two
+// binary searches.
+static void combo_filter(GUI_combo *cb)
+{
+  int32_t lo = 0, hi = cb->noptions;
+  while (lo < hi) {
+    int32_t mid = lo + (hi - lo) / 2;
+    if (fold_cmp(combo_text(cb, cb->sorted[mid]), cb->filter, cb->nfilter) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  cb->first = lo;
+  hi = cb->noptions;
+  while (lo < hi) {
+    int32_t mid = lo + (hi - lo) / 2;
+    if (fold_cmp(combo_text(cb, cb->sorted[mid]), cb->filter, cb->nfilter) <= 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  cb->count = lo - cb->first;
+  cb->top = cb->cursor = 0;
+}
 
+bool gui_combo(GUI_context *c, const double x, const double y, const double w,
+               GUI_combo *cb, int32_t *selected)
+{
+  assert(c);
+  assert(cb);
+  assert(cb->option);
+  assert(selected);
+  int32_t id = c->counter++;
+  bool rv = false;
+  const double offset = 6.0;
+  double height = f_height + 2 * offset;
+  GUI_measure *m = gui_slot(c);
+  if (!cb->open && gui_culled(c, x, y, w, height)) {
+    gui_placed(c, m, x, y, w, height);
+    return false;
+  }
+  if (!cb->indexed || cb->indexed_gen != cb->generation) {
+    if (!combo_index(cb)) {
+      cb->open = false;
+      gui_placed(c, m, x, y, w, height);
+      return false;
+    }
+    cb->nfilter = 0;
+    cb->filter[0] = 0;
+    combo_filter(cb);
+  }
+  int32_t rows = cb->rows > 0 ? cb->rows : 10;
+  double list_y = y + height;
+  // Use the real mouse if it is hidden by the drop-down. Inside a scroll
+  // region, content coordinates are offset from window coordinates.
+  double scroll = c->clipping ? c->clip_y - c->scroll_y : 0.0;
+  double mouse_x = c->mouse_x, mouse_y = c->mouse_y;
+  bool released = c->button_released;
+  float wheel = c->wheel;
+  if (c->popup_hit) {
+    mouse_x = c->popup_mouse_x;
+    mouse_y = c->popup_mouse_y + scroll;
+    released = c->popup_released;
+    wheel = c->popup_wheel;
+  }
+  bool in_box = mouse_x >= x && mouse_x - x <= w &&
+                mouse_y >= y && mouse_y - y <= height;
+  bool in_list = cb->open && mouse_x >= x && mouse_x - x <= w &&
+                 mouse_y >= list_y &&
+                 mouse_y - list_y < fmin(rows, cb->count) * height;
+  if (in_box || in_list || c->id == id) {
+    c->id = id;
+  }
+  bool focused = c->id == id;
+  // Open or close with a click on the box; close with a click elsewhere.
+  if (released) {
+    if (in_box) {
+      cb->open = !cb->open;
+    } else if (in_list) {
+      int32_t row = cb->top + (int32_t)((mouse_y - list_y) / height);
+      if (row < cb->count) {
+        *selected = cb->sorted[cb->first + row];
+        rv = true;
+      }
+      cb->open = false;
+    } else {
+      cb->open = false;
+    }
+  }
+  // The wheel scrolls the drop-down; the row under the mouse is highlighted
+  // when the mouse moves.
+  if (in_list && (wheel != 0.0f || c->mouse_dx != 0.0f ||
+                  c->mouse_dy != 0.0f)) {
+    cb->top -= (int32_t)wheel;
+    if (cb->top > cb->count - rows) {
+      cb->top = cb->count - rows;
+    }
+    if (cb->top < 0) {
+      cb->top = 0;
+    }
+    int32_t row = cb->top + (int32_t)((mouse_y - list_y) / height);
+    cb->cursor = row < cb->count ? row : cb->count - 1;
+  }
+  if (focused) {
+    int32_t key, pos = 0;
+    int16_t mod;
+    while (next_key(c, &pos, &key, &mod)) {
+      if (!cb->open) {
+        if (key == SDLK_RETURN || key == SDLK_DOWN) {
+          cb->open = true;
+        }
+      } else if (key == SDLK_RETURN) {
+        if (cb->cursor < cb->count) {
+          *selected = cb->sorted[cb->first + cb->cursor];
+          rv = true;
+        }
+        cb->open = false;
+      } else if (key == SDLK_UP) {
+        if (cb->cursor > 0) {
+          cb->cursor--;
+        }
+      } else if (key == SDLK_DOWN) {
+        if (cb->cursor < cb->count - 1) {
+          cb->cursor++;
+        }
+      } else if (key == SDLK_BACKSPACE) {
+        if (cb->nfilter > 0) {
+          cb->filter[--cb->nfilter] = 0;
+          combo_filter(cb);
+        }
+      } else if (key >= 0x20 && key <= 0x7e &&
+                 cb->nfilter < GUI_COMBO_FILTER - 1) {
+        cb->filter[cb->nfilter++] = (char)key;
+        cb->filter[cb->nfilter] = 0;
+        combo_filter(cb);
+      }
+    }
+  } else {
+    cb->open = false;
+  }
+  // Keep the cursor in view, and the view in the range.
+  if (cb->cursor < cb->top) {
+    cb->top = cb->cursor;
+  } else if (cb->cursor >= cb->top + rows) {
+    cb->top = cb->cursor - rows + 1;
+  }
+  if (cb->top > cb->count - rows) {
+    cb->top = cb->count - rows;
+  }
+  if (cb->top < 0) {
+    cb->top = 0;
+  }
+  // Draw the box with the selected option, or the filter while typing.
+  gui_rect_stroke(c, &c->fg, x, y, w, height);
+  if (focused) {
+    gui_accent(c, x+2, y+2, w-4, height-4);
+  }
+  const char *shown = "";
+  if (cb->open && cb->nfilter > 0) {
+    shown = cb->filter;
+  } else if (*selected >= 0 && *selected < cb->noptions) {
+    shown = combo_text(cb, *selected);
+  }
+  double arrow = m_height;
+  cairo_save(c->ctx);
+  cairo_rectangle(c->ctx, x, y, w - arrow - offset, height);
+  cairo_clip(c->ctx);
+  cairo_new_path(c->ctx);
+  cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
+  cairo_move_to(c->ctx, x + offset, y + (height + m_height) / 2);
+  cairo_show_text(c->ctx, shown);
+  cairo_restore(c->ctx);
+  cairo_new_path(c->ctx);
+  cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
+  cairo_move_to(c->ctx, x + w - offset - arrow, y + (height - arrow / 2) / 2);
+  cairo_rel_line_to(c->ctx, arrow, 0);
+  cairo_rel_line_to(c->ctx, -arrow / 2, arrow / 2);
+  cairo_close_path(c->ctx);
+  cairo_fill(c->ctx);
+  // Draw the visible rows of the drop-down.
+  if (cb->open) {
+    int32_t nvisible = cb->count - cb->top < rows ? cb->count - cb->top : rows;
+    double list_h = (nvisible > 0 ? nvisible : 1) * height;
+    gui_rect_fill(c, &c->bg, x, list_y, w, list_h);
+    gui_rect_stroke(c, &c->fg, x, list_y, w, list_h);
+    cairo_save(c->ctx);
+    cairo_rectangle(c->ctx, x, list_y, w, list_h);
+    cairo_clip(c->ctx);
+    for (int32_t k = 0; k < nvisible; k++) {
+      int32_t row = cb->top + k;
+      double ry = list_y + k * height;
+      if (row == cb->cursor) {
+        gui_rect_fill(c, &c->acc, x + 1, ry + 1, w - 2, height - 2);
+      }
+      cairo_new_path(c->ctx);
+      cairo_set_source_rgb(c->ctx, c->fg.r, c->fg.g, c->fg.b);
+      cairo_move_to(c->ctx, x + offset, ry + (height + m_height) / 2);
+      cairo_show_text(c->ctx, combo_text(cb, cb->sorted[cb->first + row]));
+    }
+    // Show where the rows are in the list.
+    if (cb->count > rows) {
+      double th = fmax(list_h * rows / cb->count, offset);
+      double ty = list_y + (list_h - th) * cb->top / (cb->count - rows);
+      gui_rect_fill(c, &c->fg, x + w - 4, ty, 3, th);
+    }
+    cairo_restore(c->ctx);
+    // Keep the mouse away from the widgets under the list next frame.
+    c->popup_next = (GUI_rect) {
+      x, list_y - scroll, w, list_h
+    };
+  }
+  gui_placed(c, m, x, y, w, height);
   return rv;
 }
 
+void gui_combo_free(GUI_combo *cb)
+{
+  assert(cb);
+  free(cb->sorted);
+  cb->sorted = 0;
+  cb->indexed = false;
+  cb->open = false;
+  cb->count = 0;
+}
+
+void gui_scroll_begin(GUI_context *c, const double x, const double y,
+                      const double w, const double h, const double content_h,
+                      double *state)
+{
+  assert(c);
+  assert(state);
+  assert(!c->clipping);
+  bool inside = c->mouse_x >= x && (c->mouse_x - x) <= w &&
+                c->mouse_y >= y && (c->mouse_y - y) <= h;
+  // Scroll with the mouse wheel, three lines at a time.
+  if (inside && c->wheel != 0.0f) {
+    *state -= c->wheel * 3 * f_height;
+  }
+  double maxscroll = content_h > h ? content_h - h : 0.0;
+  if (*state > maxscroll) {
+    *state = maxscroll;
+  }
+  if (*state < 0.0) {
+    *state = 0.0;
+  }
+  c->scroll_x = x;
+  c->scroll_y = y;
+  c->scroll_w = w;
+  c->scroll_h = h;
+  c->scroll_content = content_h;
+  c->scroll_state = state;
+  gui_placed(c, gui_slot(c), x, y, w, h);
+  // The clip rectangle is in content coordinates.
+  c->clipping = true;
+  c->clip_x = x;
+  c->clip_y = y + round(*state);
+  c->clip_w = w;
+  c->clip_h = h;
+  // Translate the mouse into content coordinates, and move it out of the way
+  // if it is not in the region, so hidden widgets are not hovered.
+  c->saved_mouse_x = c->mouse_x;
+  c->saved_mouse_y = c->mouse_y;
+  // The region uses the wheel when the mouse is in it; the widgets inside
+  // never get it, and those after the region only when it was not used.
+  c->saved_wheel = inside ? 0.0f : c->wheel;
+  c->wheel = 0.0f;
+  if (inside) {
+    c->mouse_y += (int32_t)round(*state);
+  } else {
+    c->mouse_x = c->mouse_y = INT32_MIN/2;
+  }
+  cairo_save(c->ctx);
+  cairo_new_path(c->ctx);
+  cairo_rectangle(c->ctx, x, y, w, h);
+  cairo_clip(c->ctx);
+  cairo_translate(c->ctx, 0.0, -round(*state));
+}
+
+void gui_scroll_end(GUI_context *c)
+{
+  assert(c);
+  assert(c->clipping);
+  cairo_restore(c->ctx);
+  c->clipping = false;
+  c->mouse_x = c->saved_mouse_x;
+  c->mouse_y = c->saved_mouse_y;
+  c->wheel = c->saved_wheel;
+  // Draw the scroll bar if the content does not fit.
+  double h = c->scroll_h;
+  if (c->scroll_content > h) {
+    const double barwidth = 6.0;
+    double thumb = h * h / c->scroll_content;
+    double pos = *c->scroll_state / (c->scroll_content - h) * (h - thumb);
+    gui_rect_fill(c, &c->acc, c->scroll_x + c->scroll_w - barwidth,
+                    c->scroll_y + pos, barwidth, thumb);
+  }
+}
+
+// Position of the next item in a layout, for an item of the given size.
+static void layout_position(const GUI_layout *l, double w, double h,
+                            double *x, double *y)
+{
+  double across = l->dir == GUI_COLUMN ? w : h;
+  double room = l->size > 0.0 ? l->size : l->prev_extent;
+  double shift = 0.0;
+  if (l->align == GUI_ALIGN_CENTER) {
+    shift = (room - across) / 2;
+  } else if (l->align == GUI_ALIGN_END) {
+    shift = room - across;
+  }
+  if (shift < 0.0) {
+    shift = 0.0;
+  }
+  if (l->dir == GUI_COLUMN) {
+    *x = l->x + shift;
+    *y = l->y + l->pos;
+  } else {
+    *x = l->x + l->pos;
+    *y = l->y + shift;
+  }
+}
+
+// Record the bounding box of a widget. If its position came from a layout,
+// the layout advances past it.
+static void gui_placed(GUI_context *c, GUI_measure *m, double x, double y,
+                       double w, double h)
+{
+  if (m) {
+    m->w = w;
+    m->h = h;
+  }
+  GUI_layout *l = c->layout;
+  if (!l || !l->pending) {
+    return;
+  }
+  l->pending = false;
+  // Use the actual extent of the widget from the origin of the layout.
+  double along, across;
+  if (l->dir == GUI_COLUMN) {
+    along = y + h - l->y;
+    across = x + w - l->x;
+  } else {
+    along = x + w - l->x;
+    across = y + h - l->y;
+  }
+  l->pos = along + l->spacing;
+  if (across > l->extent) {
+    l->extent = across;
+  }
+}
+
+void gui_layout_begin(GUI_context *c, GUI_layout *l, const double x,
+                      const double y)
+{
+  assert(c);
+  assert(l);
+  l->x = x;
+  l->y = y;
+  l->parent = c->layout;
+  // A nested layout aligns itself in its parent using its previous size.
+  if (l->parent && l->parent->pending) {
+    layout_position(l->parent, l->prev_w, l->prev_h, &l->x, &l->y);
+  }
+  l->pos = 0.0;
+  l->extent = 0.0;
+  l->pending = false;
+  c->layout = l;
+}
+
+void gui_layout_next(GUI_context *c, double *x, double *y)
+{
+  assert(c);
+  assert(c->layout);
+  assert(x && y);
+  GUI_layout *l = c->layout;
+  // The next widget (or canvas, scroll region or group) will take the next
+  // measurement slot. Its size in the previous frame is used for alignment.
+  double w = 0.0, h = 0.0;
+  if (c->slot < c->nslots) {
+    w = c->mcache[c->slot].w;
+    h = c->mcache[c->slot].h;
+  }
+  layout_position(l, w, h, x, y);
+  l->pending = true;
+}
+
+void gui_layout_end(GUI_context *c)
+{
+  assert(c);
+  assert(c->layout);
+  GUI_layout *l = c->layout;
+  double along = l->pos > 0.0 ? l->pos - l->spacing : 0.0;
+  double room = l->size > 0.0 ? l->size : l->extent;
+  l->prev_extent = l->extent;
+  if (l->dir == GUI_COLUMN) {
+    l->prev_w = room;
+    l->prev_h = along;
+  } else {
+    l->prev_w = along;
+    l->prev_h = room;
+  }
+  c->layout = l->parent;
+  gui_placed(c, 0, l->x, l->y, l->prev_w, l->prev_h);
+}
+
+// How the widgets in a group are handled in this frame.
+#define GROUP_LIVE 1    // Drawn directly.
+#define GROUP_RECORD 2  // Drawn into the cache.
+#define GROUP_CACHED 3  // Not called; the cache is shown.
+
+// Mix value v into hash h.
+static uint64_t hash_mix(uint64_t h, uint64_t v)
+{
+  h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+  return h;
+}
+
+static uint64_t hash_double(uint64_t h, double d)
+{
+  uint64_t v;
+  memcpy(&v, &d, sizeof(v));
+  return hash_mix(h, v);
+}
+
+bool gui_group_begin(GUI_context *c, uint32_t key, const double x,
+                     const double y, const double w, const double h,
+                     uint64_t hash)
+{
+  assert(c);
+  assert(!c->group);
+  // Find the group, or replace the least recently used one.
+  GUI_group *g = &c->groups[0];
+  for (int k = 0; k < GUI_MAX_GROUPS; k++) {
+    if (c->groups[k].key == key && c->groups[k].used) {
+      g = &c->groups[k];
+      break;
+    }
+    if (c->groups[k].used < g->used) {
+      g = &c->groups[k];
+    }
+  }
+  if (g->key != key || !g->used) {
+    g->key = key;
+    g->valid = false;
+    g->nids = g->nslots = 0;
+  }
+  g->used = c->frame;
+  c->group = g;
+  gui_placed(c, gui_slot(c), x, y, w, h);
+  // Everything the rendering depends on besides the caller's data.
+  hash = hash_double(hash, c->fg.r);
+  hash = hash_double(hash, c->fg.g);
+  hash = hash_double(hash, c->fg.b);
+  hash = hash_double(hash, c->bg.r);
+  hash = hash_double(hash, c->bg.g);
+  hash = hash_double(hash, c->bg.b);
+  hash = hash_double(hash, c->acc.r);
+  hash = hash_double(hash, c->acc.g);
+  hash = hash_double(hash, c->acc.b);
+  hash = hash_mix(hash, c->font_serial);
+  hash = hash_mix(hash, c->quality);
+  int32_t ox = floor(x), oy = floor(y);
+  int32_t gw = ceil(x + w) - ox, gh = ceil(y + h) - oy;
+  // The IDs of the widgets are known after any pass, live or recorded. A
+  // widget with focus is drawn live, so its accent never ends up in the
+  // cache.
+  bool interacting = (c->mouse_x >= x && (c->mouse_x - x) <= w &&
+                      c->mouse_y >= y && (c->mouse_y - y) <= h) ||
+                     (c->id >= g->firstid && c->id < g->firstid + g->nids);
+  if (g->valid && !interacting &&
+      (g->hash == hash || gui_culled(c, x, y, w, h))) {
+    g->mode = GROUP_CACHED;
+    // Keep IDs and measurement slots of later widgets stable.
+    c->counter += g->nids;
+    c->slot += g->nslots;
+    if (!gui_culled(c, x, y, w, h)) {
+      cairo_new_path(c->ctx);
+      cairo_set_source_surface(c->ctx, g->surface, g->ox, g->oy);
+      cairo_rectangle(c->ctx, g->ox, g->oy, g->w, g->h);
+      cairo_fill(c->ctx);
+    }
+    return false;
+  }
+  g->firstid = c->counter;
+  g->firstslot = c->slot;
+  g->valid = false;
+  if (interacting || gui_culled(c, x, y, w, h)) {
+    // Widgets react to the user, so draw them directly. The cache is made
+    // again when the user is done.
+    g->mode = GROUP_LIVE;
+    return true;
+  }
+  if (!g->surface || g->w != gw || g->h != gh) {
+    if (g->surface) {
+      cairo_surface_destroy(g->surface);
+    }
+    g->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, gw, gh);
+    g->w = gw;
+    g->h = gh;
+  }
+  if (cairo_surface_status(g->surface) != CAIRO_STATUS_SUCCESS) {
+    g->mode = GROUP_LIVE;
+    return true;
+  }
+  g->ox = ox;
+  g->oy = oy;
+  g->hash = hash;
+  g->mode = GROUP_RECORD;
+  // Draw into the cache; widget coordinates stay the same.
+  c->group_saved = c->ctx;
+  c->ctx = cairo_create(g->surface);
+  apply_quality(c, c->ctx);
+  cairo_set_source_rgb(c->ctx, c->bg.r, c->bg.g, c->bg.b);
+  cairo_paint(c->ctx);
+  cairo_set_font_size(c->ctx, c->font_used);
+  cairo_translate(c->ctx, -ox, -oy);
+  return true;
+}
+
+void gui_group_end(GUI_context *c)
+{
+  assert(c);
+  assert(c->group);
+  GUI_group *g = c->group;
+  c->group = 0;
+  if (g->mode == GROUP_CACHED) {
+    return;
+  }
+  g->nids = c->counter - g->firstid;
+  g->nslots = c->slot - g->firstslot;
+  if (g->mode == GROUP_RECORD) {
+    cairo_destroy(c->ctx);
+    c->ctx = c->group_saved;
+    c->group_saved = 0;
+    cairo_surface_flush(g->surface);
+    g->valid = true;
+    cairo_new_path(c->ctx);
+    cairo_set_source_surface(c->ctx, g->surface, g->ox, g->oy);
+    cairo_rectangle(c->ctx, g->ox, g->oy, g->w, g->h);
+    cairo_fill(c->ctx);
+  }
+}
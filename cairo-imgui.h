@@ -5,7 +5,7 @@
 // Author: R.F. Smith <rsmith@xs4all.nl>
 // SPDX-License-Identifier: Unlicense
 // Created: 2025-08-26 12:57:19 +0200
-// Last modified: 2025-09-26T22:33:15+0200
+// Last modified: 2026-10-18T10:12:40+0200
 
 // Simple immediate mode GUI for SDL3 and Cairo.
 
@@ -15,6 +15,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #include <SDL3/SDL.h>
 #include <cairo/cairo.h>
@@ -25,22 +26,250 @@ typedef struct {
   double b;
 } GUI_rgb;
 
+typedef struct {
+  double x, y, w, h;
+} GUI_rect;
+
+// Layouts compute the positions of widgets. Set dir, align, spacing and
+// optionally size once (e.g. in a static definition); the rest is managed by
+// the layout functions.
+typedef enum {
+  GUI_COLUMN,
+  GUI_ROW
+} GUI_direction;
+
+typedef enum {
+  GUI_ALIGN_START,
+  GUI_ALIGN_CENTER,
+  GUI_ALIGN_END
+} GUI_align;
+
+typedef struct GUI_layout {
+  GUI_direction dir;
+  GUI_align align;
+  double spacing;
+  double size;        // Room across the layout direction; 0 means the
+                      // size of the largest item.
+  double x, y;
+  double pos;
+  double extent;
+  double prev_extent;
+  double prev_w, prev_h;
+  bool pending;
+  struct GUI_layout *parent;
+} GUI_layout;
+
+struct GUI_measure;
+
+// Icon atlas. Icons are drawn once, at the size they are shown, into a
+// single surface; widgets draw them with one blit. The surface starts at
+// 256×256 pixels and is repacked, doubling its size when needed, up to max
+// pixels square.
+typedef struct {
+  int32_t x, y, w, h;
+} GUI_icon;
+
+struct GUI_shelf;
+
+typedef struct {
+  cairo_surface_t *surface;
+  int32_t size;       // Width and height of the surface.
+  int32_t max;        // Largest size; 0 means 2048.
+  GUI_icon *icons;
+  int32_t nicons, cap;
+  struct GUI_shelf *shelves;
+  int32_t nshelves, shelf_cap;
+  uint32_t repacks;
+} GUI_atlas;
+
+// Lock-free queue to pass values and log lines from worker threads to the
+// GUI. The details are private to cairo-imgui.c.
+typedef struct GUI_queue GUI_queue;
+
+// Lines of text received through a queue, kept in a ring.
+#define GUI_LOG_LINES 64
+#define GUI_LOG_WIDTH 120
+typedef struct {
+  char lines[GUI_LOG_LINES][GUI_LOG_WIDTH];
+  int32_t first;
+  int32_t count;
+} GUI_log;
+
+// Where gui_begin puts the contents of a queue.
+typedef struct {
+  GUI_queue *queue;
+  double *values;
+  int32_t nvalues;
+  GUI_log *log;
+} GUI_feed;
+#define GUI_MAX_FEEDS 4
+
+// Cached rendering of a group of widgets.
+typedef struct {
+  uint32_t key;
+  uint64_t hash;        // Input hash of the cached rendering.
+  uint64_t used;        // Frame in which the group was last used.
+  cairo_surface_t *surface;
+  int32_t ox, oy;       // Position of the surface.
+  int32_t w, h;
+  int32_t firstid, nids;
+  int32_t firstslot, nslots;
+  int32_t mode;
+  bool valid;
+} GUI_group;
+#define GUI_MAX_GROUPS 16
+
+// Frame capture. A recording starts with the 8 bytes of GUI_REC_MAGIC.
+// Every frame is a GUI_rec_frame, followed by nruns runs of pixels. A run is
+// the index of its first pixel and the number of pixels (both uint32_t),
+// followed by that many ARGB32 pixels. Runs replace pixels of the previous
+// frame; a frame with a different size starts from an all-zero frame.
+// Everything is in native byte order.
+#define GUI_REC_MAGIC "CIGREC01"
+typedef struct {
+  uint64_t timestamp;   // SDL_GetTicksNS when the frame was finished.
+  uint32_t width, height;
+  uint32_t nruns;
+  uint32_t reserved;
+} GUI_rec_frame;
+
+typedef struct GUI_capture GUI_capture;
+
+// Quality levels. Every level includes the reductions of the levels above.
+#define GUI_QUALITY_FULL 0
+#define GUI_QUALITY_NO_AA 1         // No anti-aliasing of shapes.
+#define GUI_QUALITY_NO_HINTING 2    // Text without hinting or anti-aliasing.
+#define GUI_QUALITY_NO_ACCENTS 3    // No accent outlines on hover/focus.
+
+// Input-to-photon latency, split into stages: waiting for gui_begin, the
+// widget pass, rasterisation and upload, and presenting. Every input event
+// adds a sample to the queue and total stages, measured from its own
+// timestamp to the frame that consumed it; the other stages get one sample
+// per frame that consumed input. Bucket k of a histogram counts durations
+// of [2^k, 2^(k+1)) µs; bucket 0 includes everything below 2 µs.
+#define GUI_LAT_QUEUE 0
+#define GUI_LAT_WIDGETS 1
+#define GUI_LAT_RASTER 2
+#define GUI_LAT_PRESENT 3
+#define GUI_LAT_TOTAL 4
+#define GUI_LAT_STAGES 5
+#define GUI_LAT_BUCKETS 24
+typedef struct {
+  uint32_t hist[GUI_LAT_STAGES][GUI_LAT_BUCKETS];
+  uint64_t sum_ns[GUI_LAT_STAGES];
+  uint64_t max_ns[GUI_LAT_STAGES];
+  uint64_t last_ns[GUI_LAT_STAGES];
+  uint64_t samples[GUI_LAT_STAGES];
+  uint64_t count;       // Frames that consumed input.
+  uint64_t last_frame;  // Last frame that consumed input.
+} GUI_latency;
+
+// Input for one frame. Events are queued in the order they arrive; runs of
+// mouse motion or wheel events are merged into one event with the summed
+// deltas. Each frame takes the queued events up to and including the
+// next button release, so quick clicks are not lost.
+#define GUI_INPUT_MOTION 0
+#define GUI_INPUT_BUTTON_DOWN 1
+#define GUI_INPUT_BUTTON_UP 2
+#define GUI_INPUT_KEY 3
+#define GUI_INPUT_WHEEL 4
+#define GUI_MAX_INPUT 128
+typedef struct {
+  uint8_t type;
+  uint8_t button;
+  int16_t mod;
+  int32_t key;
+  float x, y;
+  float dx, dy;
+  uint64_t timestamp;
+} GUI_input;
+
+// Size of the tiles that are compared to find what changed when drawing
+// directly on the window surface.
+#define GUI_TILE 64
+
 typedef struct {
   SDL_Renderer *renderer;
   SDL_Texture *texture;
+  SDL_Window *window;
+  SDL_Surface *shadow;
+  uint32_t *last;             // Last frame presented on the window surface.
+  SDL_Rect *damage;
+  int32_t last_w, last_h;
   cairo_surface_t *surface;
   cairo_t *ctx;
   int32_t mouse_x, mouse_y;
+  float mouse_dx, mouse_dy;   // Motion in this frame.
+  float wheel;
   int32_t id;
   int32_t keycode;
   int32_t counter;
   int32_t maxid;
   int16_t mod;
+  uint8_t button;
   bool button_pressed;
   bool button_released;
   GUI_rgb fg;
   GUI_rgb bg;
   GUI_rgb acc;
+  double font_size;   // 0 means the default of 14.
+  double font_used;
+  uint32_t font_serial;
+  // Measurement cache, one slot per widget.
+  struct GUI_measure *mcache;
+  int32_t nslots;
+  int32_t slot;
+  GUI_layout *layout;
+  GUI_feed feeds[GUI_MAX_FEEDS];
+  uint64_t frame;
+  GUI_group groups[GUI_MAX_GROUPS];
+  GUI_group *group;
+  cairo_t *group_saved;
+  // Quality governor. When budget_ms is larger than 0, quality is lowered
+  // while frames take longer than that, and raised when there is room.
+  double budget_ms;
+  double frame_ms;            // Cost of the last frame.
+  uint64_t frame_start;
+  int32_t quality;            // Current level, GUI_QUALITY_*.
+  int32_t over, under;
+  uint32_t quality_down;      // Number of transitions in both directions.
+  uint32_t quality_up;
+  GUI_capture *capture;
+  uint64_t capture_written, capture_dropped;
+  // Table of retained widget state. Keys are probed in their own array;
+  // an entry is removed when it has not been used for state_ttl frames.
+  uint64_t *state_keys;
+  uint32_t *state_used;
+  void **state_data;
+  int32_t state_cap, state_count;
+  uint32_t state_ttl;         // 0 means 60 frames.
+  // Queued input, and the input of this frame.
+  GUI_input pending[GUI_MAX_INPUT];
+  int32_t npending;
+  GUI_input events[GUI_MAX_INPUT];
+  int32_t nevents;
+  uint64_t input_dropped;
+  GUI_latency latency;
+  GUI_atlas atlas;
+  uint64_t lat_begin;
+  // Drop-down list that was open in the previous frame, in window
+  // coordinates. While the mouse is over it, widgets see the mouse far away
+  // and no buttons or wheel, so a click does not reach the widgets under the
+  // list; the real input is kept in the popup_* fields for its owner.
+  GUI_rect popup, popup_next;
+  bool popup_hit;
+  int32_t popup_mouse_x, popup_mouse_y;
+  bool popup_pressed, popup_released;
+  float popup_wheel;
+  // Scroll region, in content coordinates. Widgets that fall completely
+  // outside the clip rectangle are not measured or drawn.
+  bool clipping;
+  double clip_x, clip_y, clip_w, clip_h;
+  double scroll_x, scroll_y, scroll_w, scroll_h;
+  double scroll_content;
+  double *scroll_state;
+  int32_t saved_mouse_x, saved_mouse_y;
+  float saved_wheel;
 } GUI_context;
 
 #define EBUF_SIZE 256
@@ -52,6 +281,57 @@ typedef struct {
   ptrdiff_t displaypos;
 } GUI_editstate;
 
+// A canvas shows a large number of items in world coordinates.
+// The user can pan it by dragging with the middle or right mouse button, and
+// zoom with the mouse wheel. A uniform grid over the item bounding boxes is
+// used to find the visible items and the item under the cursor, so only
+// those have to be considered every frame.
+typedef struct {
+  GUI_rect *items;    // Bounding boxes in world coordinates.
+  int32_t nitems;
+  int32_t capacity;
+  double pan_x, pan_y; // World coordinates of the top left of the view.
+  double zoom;        // 0 is treated as 1.
+  bool dirty;         // Grid needs to be rebuilt.
+  bool dragging;
+  double drag_x, drag_y;
+  double cell;        // Size of a grid cell in world coordinates.
+  double gx, gy;      // Origin of the grid.
+  int32_t gw, gh;
+  int32_t *cellstart; // gw*gh+1 offsets into cellitems.
+  int32_t *cellitems;
+  uint32_t *mark;
+  uint32_t stamp;
+  int32_t *visible;   // Indices of the visible items, in drawing order.
+  int32_t nvisible;
+  int32_t hover;      // Topmost item under the cursor, or -1.
+} GUI_canvas;
+
+// A combo box picks one of a large number of options. The options are read
+// through an accessor, and must not change while the generation stays the
+// same; the strings it returns must stay valid as long. A sorted index is
+// made once per generation. Typing while the drop-down is open selects the
+// options that start with the typed text (ignoring case), found by binary
+// search. Only the visible rows of the drop-down are drawn.
+typedef const char *(*GUI_option)(void *data, int32_t index);
+#define GUI_COMBO_FILTER 64
+typedef struct {
+  int32_t noptions;
+  GUI_option option;
+  void *data;
+  uint32_t generation;  // Increase when the options change.
+  int32_t rows;         // Rows in the drop-down; 0 means 10.
+  bool indexed;
+  uint32_t indexed_gen; // Generation of the index.
+  int32_t *sorted;      // Option indices, sorted by text.
+  int32_t first, count; // Range of sorted that matches the filter.
+  char filter[GUI_COMBO_FILTER];
+  int32_t nfilter;
+  bool open;
+  int32_t top;          // First row shown in the drop-down.
+  int32_t cursor;       // Highlighted row.
+} GUI_combo;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -64,8 +344,29 @@ extern "C" {
 // All calls to GUI elements and all Cairo calls should *only* be done between
 // gui_begin and gui_end;
 void gui_begin(SDL_Renderer *renderer, SDL_Texture *texture, GUI_context *out);
+// Use this instead of gui_begin to draw directly on the surface of a window
+// that has no renderer. Only the parts that changed are presented.
+void gui_begin_window(SDL_Window *window, GUI_context *out);
 void gui_end(GUI_context *ctx);
 
+// Record every finished frame to a file, using nbuffers frame buffers to
+// hand frames to a writer thread. gui_end never waits for the writer; when
+// all buffers are in use, the frame is dropped. Returns false if the file or
+// the thread could not be created.
+bool gui_capture_start(GUI_context *c, const char *path, int32_t nbuffers);
+void gui_capture_stop(GUI_context *c);
+// Number of frames written and dropped by the current or last capture.
+void gui_capture_stats(const GUI_context *c, uint64_t *written,
+                       uint64_t *dropped);
+
+// Clear the latency statistics in c->latency.
+void gui_latency_reset(GUI_context *c);
+// Write the latency statistics as text.
+void gui_latency_dump(const GUI_context *c, FILE *f);
+
+// Release the memory held by the context.
+void gui_free(GUI_context *ctx);
+
 // Call this to process events in SDL_AppEvent.
 SDL_AppResult gui_process_events(GUI_context *ctx, SDL_Event *event);
 
@@ -73,6 +374,15 @@ SDL_AppResult gui_process_events(GUI_context *ctx, SDL_Event *event);
 void gui_theme_light(GUI_context *ctx);
 void gui_theme_dark(GUI_context *ctx);
 
+// Return memory of the given size that is kept between frames, for as long
+// as it is used every frame. It is zeroed when first created; *isnew (if not
+// NULL) tells whether that happened. Key 0 is not allowed.
+// Returns NULL when out of memory.
+void *gui_state(GUI_context *c, uint64_t key, size_t size, bool *isnew);
+
+// FNV-1a hash of a string, e.g. to make a key for gui_state from a label.
+uint64_t gui_hash(const char *s);
+
 // Show a button. Returns true when the button is pressed.
 bool gui_button(GUI_context *c, double x, double y, const char *label);
 
@@ -103,6 +413,103 @@ bool gui_ispinner(GUI_context *c, const double x, const double y,
 bool gui_editbox(GUI_context *c, const double x, const double y, const double w,
                  GUI_editstate *state);
 
+// Add an item to a canvas. Returns the index of the item, or -1 if memory
+// could not be allocated.
+int32_t gui_canvas_add(GUI_canvas *cv, double x, double y, double w, double h);
+
+// Change the bounding box of an existing item.
+void gui_canvas_set(GUI_canvas *cv, int32_t item, double x, double y,
+                    double w, double h);
+
+// Release the memory used by a canvas.
+void gui_canvas_free(GUI_canvas *cv);
+
+// Show a canvas in the given rectangle on the screen.
+// Returns the number of visible items; their indices are in cv->visible.
+// Between gui_canvas_begin and gui_canvas_end, c->ctx is clipped to the
+// canvas and transformed so that items can be drawn in world coordinates.
+int32_t gui_canvas_begin(GUI_context *c, GUI_canvas *cv, const double x,
+                         const double y, const double w, const double h);
+void gui_canvas_end(GUI_context *c, GUI_canvas *cv);
+
+// Draw a combo box of width w. *selected is the index of the shown option,
+// or -1. Returns true when an option is chosen. The drop-down is drawn
+// below the box, over whatever was drawn before; call gui_combo after the
+// widgets it may cover. Those widgets do not see the mouse while it is over
+// the open list.
+bool gui_combo(GUI_context *c, const double x, const double y, const double w,
+               GUI_combo *cb, int32_t *selected);
+void gui_combo_free(GUI_combo *cb);
+
+// Start a vertically scrolling region. Widgets between gui_scroll_begin and
+// gui_scroll_end are positioned as if the region was not scrolled;
+// content_h is the total height of the content. The scroll offset is
+// kept in *state. Scroll regions cannot be nested. The region takes the
+// mouse wheel when the mouse is over it; widgets inside it do not see the
+// wheel.
+void gui_scroll_begin(GUI_context *c, const double x, const double y,
+                      const double w, const double h, const double content_h,
+                      double *state);
+void gui_scroll_end(GUI_context *c);
+
+// Add an icon to the atlas, scaled to w×h pixels (only image surfaces are
+// scaled). Returns the number of the icon, or -1 if it could not be added,
+// e.g. when the atlas is full. To use an icon at two sizes, add it twice.
+int32_t gui_icon_add(GUI_context *c, cairo_surface_t *src, int32_t w,
+                     int32_t h);
+int32_t gui_icon_add_png(GUI_context *c, const char *path, int32_t w,
+                         int32_t h);
+// Draw icon with its top left corner at x, y.
+void gui_icon(GUI_context *c, int32_t icon, double x, double y);
+// Remove all icons. gui_free also does this.
+void gui_atlas_free(GUI_context *c);
+// A button with an icon left of the label. The label may be NULL.
+bool gui_iconbutton(GUI_context *c, double x, double y, int32_t icon,
+                    const char *label);
+
+// Start a layout at x, y. Before each widget in the layout, call
+// gui_layout_next to get its position. Layouts can be nested; a nested
+// layout is started with the position returned by gui_layout_next of its
+// parent.
+// Alignment uses the size that widgets had in the previous frame.
+void gui_layout_begin(GUI_context *c, GUI_layout *l, const double x,
+                      const double y);
+void gui_layout_next(GUI_context *c, double *x, double *y);
+void gui_layout_end(GUI_context *c);
+
+// Create a queue that holds at least capacity messages. If multi is false,
+// only a single thread may push messages into it. Returns NULL when out of
+// memory.
+GUI_queue *gui_queue_create(size_t capacity, bool multi);
+void gui_queue_destroy(GUI_queue *q);
+
+// Push a value or a line of text from a worker thread. These never block;
+// they return false and count the message as dropped when the queue is full.
+bool gui_queue_push_value(GUI_queue *q, int32_t index, double value);
+bool gui_queue_push_text(GUI_queue *q, const char *text);
+size_t gui_queue_dropped(GUI_queue *q);
+
+// Let gui_begin drain a queue. A value with index k is stored in values[k]
+// (if k < nvalues), text is added to *log. Either may be NULL.
+// Returns false if there are already GUI_MAX_FEEDS queues attached.
+bool gui_queue_attach(GUI_context *c, GUI_queue *q, double *values,
+                      int32_t nvalues, GUI_log *log);
+void gui_queue_detach(GUI_context *c, GUI_queue *q);
+
+// Return line k of a log, where 0 is the oldest line, or NULL.
+const char *gui_log_line(const GUI_log *log, int32_t k);
+
+// Start a group of widgets that is rendered into a cached surface. While
+// the hash is the same as when the cache was made, and the mouse is not in
+// the group and no widget in it has focus, the cached surface is shown and
+// gui_group_begin returns false; the widget calls in the group should then
+// be skipped. Pass 0 as hash if the group only depends on the theme and the
+// font. gui_group_end must always be called.
+bool gui_group_begin(GUI_context *c, uint32_t key, const double x,
+                     const double y, const double w, const double h,
+                     uint64_t hash);
+void gui_group_end(GUI_context *c);
+
 // TODO:
 // * spinner
 // * edit field
@@ -111,7 +518,6 @@ bool gui_editbox(GUI_context *c, const double x, const double y, const double w,
 // * image
 //
 // Optional
-// * Add icons to buttons.
 // * cycle button (same interface as radiobutton)
 // * info bar (label with different background color)
 